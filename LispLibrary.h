@@ -9,6 +9,11 @@
 */
 
 const char LispLibrary[] PROGMEM = R"lisplibrary(
+;
+; Load the saved image of this library instead, if there is one
+;
+(library-image)
+
 ;
 ; Extended ULOS functions
 ;
@@ -31,23 +36,7 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
   )
 )
 
-; Get the value of a property slot in an instance/class or its parents
-(defun gtv (obj slot)
-  (when (symbolp obj) (setq obj (eval obj)))
-  (let ((pair (assoc slot obj)))
-    (if pair (cdr pair)
-           (let ((p (cdr (assoc 'parent obj))))
-             (and p (gtv p slot))))
-  )
-)
-
-; Update a property in an instance/class
-(defun stv (obj slot value)
-  (when (symbolp obj) (setq obj (eval obj)))
-  (let ((pair (assoc slot obj)))
-    (when pair (setf (cdr pair) value))
-  )
-)
+; gtv, stv and cmt are native, in extensions.ino
 
 ; Add property and method slots
 (defun adp (obj slots)
@@ -60,12 +49,6 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
   )
 )
 
-; Call a method in an object instance
-;
-(defun cmt (obj method &rest arguments) 
-	(apply (eval (gtv obj method)) (append (list obj) arguments))
-)
-
 (defun write-text (str)
   (with-gfx (scr)
     (princ str scr)
@@ -75,92 +58,233 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 ;
 ; LispBox screen editor
 ;
+; The editor itself is the module LispEditor below, loaded the first time it's used.
+; Set se:unload to unload it again each time the editor exits.
 ;
-(defun se:init (sk)
+(defvar se:perfline nil)
+(defvar se:unload nil)
+
+(defun se:sedit (&optional myform myskin)
+	(module-load 'editor)
+	(let ((result (se:edit myform myskin)))
+		(when se:unload (module-unload 'editor))
+		result
+	)
+)
+
+(defun se:stats (&optional reset)
+	(let* ((pc (perf-counters reset))
+		   (keys (max 1 (first pc)))
+		   (lim 1)
+		   (b 0))
+		(format t "Keys ~a: last ~a us, p50 ~a us, p99 ~a us, max ~a us~%" (first pc) (second pc) (third pc) (nth 3 pc) (nth 4 pc))
+		(format t "Per key: screen-refresh ~a us (colouring ~a us), bracket-partner ~a us~%"
+			(floor (nth 5 pc) keys) (floor (nth 6 pc) keys) (floor (nth 7 pc) keys))
+		(format t "Conses ~a, GCs ~a~%" (nth 8 pc) (nth 9 pc))
+		(format t "Display ~a pixels, ~a bytes; SD ~a bytes read, ~a written~%" (nth 10 pc) (nth 11 pc) (nth 12 pc) (nth 13 pc))
+		(format t "Keys by time:")
+		(dolist (n (nth 14 pc))
+			(unless (zerop n)
+				(if (= b 19)
+					(format t " >=~a us:~a" (floor lim 2) n)
+					(format t " <~a us:~a" lim n)
+				)
+			)
+			(setq lim (* lim 2))
+			(incf b)
+		)
+		(terpri)
+		nil
+	)
+)
+
+;
+; Helper functions
+;
+;
+(defun constrain (value mini maxi)
+  (min (max value mini) maxi)
+)
+
+(defun split-string-to-list (delim str)
+	(unless (or (eq str nil) (not (stringp str))) 
+		(string-split delim str)
+  )
+)
+
+(defun char-list-to-string (clist)
+	(string-join clist)
+)
+
+(defun to-hex-char (i)
+	(unless (equal i nil)
+		(let ((i (abs i))) 
+			(code-char (+ i (if (<= i 9) 48 55)) )
+		)
+	)
+)
+
+(defun byte-to-hexstr (i)
+	(unless (equal i nil)
+		(let ((i (abs i))) 
+		 (concatenate 'string (string (to-hex-char (ash i -4))) (string (to-hex-char (logand i 15))) ) 
+		)
+	)
+)
+
+(defun word-to-hexstr (i)
+	(unless (equal i nil)
+		(let ((i (abs i))) 
+		 (concatenate 'string (byte-to-hexstr (ash i -8)) (byte-to-hexstr (logand i 255))) 
+		)
+	)
+)
+
+(defun hexstr-to-int (s)
+	(read-from-string (concatenate 'string "#x" s))
+)
+
+(defun remove-if (fn lis)
+  (mapcan #'(lambda (item) (unless (funcall fn item) (list item))) lis)
+ )
+
+(defun remove-if-not (fn lis)
+  (mapcan #'(lambda (item) (when (funcall fn item) (list item))) lis)
+)
+
+(defun remove_item (ele lis)
+	(remove-if (lambda (item) (equal ele item)) lis)
+)
+
+(defun remove (place lis)
+	(let ((newlis ()))
+		(dotimes (i place)
+			(push (pop lis) newlis)
+		)
+		(pop lis)
+		(dotimes (i (length lis))
+			(push (pop lis) newlis)
+		)
+		(reverse newlis)
+	)
+)
+
+(defun assoc* (a alist test)
+  (cond
+   ((null alist) nil)
+   ((funcall test a (caar alist)) (car alist))
+   (t (assoc* a (cdr alist) test))
+  )
+)
+
+(defun reverse-assoc* (a alist test)
+  (cond
+   ((null alist) nil)
+   ((funcall test a (cdar alist)) (caar alist))
+   (t (reverse-assoc* a (cdr alist) test))
+  )
+)
+
+(defun get-obj (aname anum)
+	(read-from-string (eval (concatenate 'string aname (string anum))))
+)
+
+
+
+;
+; Save the library as an image for the next reset
+;
+(library-image t)
+)lisplibrary";
+
+// The screen editor, evaluated by (module-load 'editor) when se:sedit is first called
+const char LispEditor[] PROGMEM = R"lispeditor(
+;
+; LispBox screen editor
+;
+;
+#| Palette indices: 0 code, 1 line numbers, 2 border, 3 background, 4 cursor, 5 emphasis, 6 alert, 7 input |#
+(defvar se:code_col nil) (defvar se:line_col nil) (defvar se:border_col nil) (defvar se:bg_col nil)
+(defvar se:cursor_col nil) (defvar se:emph_col nil) (defvar se:alert_col nil) (defvar se:input_col nil)
+(defvar se:string_col nil) (defvar se:comment_col nil) (defvar se:number_col nil) (defvar se:keyword_col nil)
+
+(defun se:skin (sk)
 	(case sk 
 		(t 
-		 (defvar se:code_col (class 'color '(red 220 green 220 blue 220)))
-		 (defvar se:line_col (class 'color '(red 90 green 90 blue 90)))
-		 (defvar se:border_col (class 'color '(red 63 green 40 blue 0)))
-		 (defvar se:bg_col (class 'color '(red 0 green 0 blue 0)))
-		 (defvar se:cursor_col (class 'color '(red 160 green 60 blue 0)))
-		 (defvar se:emph_col (class 'color '(red 0 green 128 blue 0)))
-		 (defvar se:alert_col (class 'color '(red 235 green 0 blue 0)))
-		 (defvar se:input_col (class 'color '(red 220 green 220 blue 220)))
+		 (setf se:code_col (class 'color '(red 220 green 220 blue 220)))
+		 (setf se:line_col (class 'color '(red 90 green 90 blue 90)))
+		 (setf se:border_col (class 'color '(red 63 green 40 blue 0)))
+		 (setf se:bg_col (class 'color '(red 0 green 0 blue 0)))
+		 (setf se:cursor_col (class 'color '(red 160 green 60 blue 0)))
+		 (setf se:emph_col (class 'color '(red 0 green 128 blue 0)))
+		 (setf se:alert_col (class 'color '(red 235 green 0 blue 0)))
+		 (setf se:input_col (class 'color '(red 220 green 220 blue 220)))
+		 (setf se:string_col (class 'color '(red 200 green 160 blue 80)))
+		 (setf se:comment_col (class 'color '(red 110 green 130 blue 110)))
+		 (setf se:number_col (class 'color '(red 120 green 180 blue 230)))
+		 (setf se:keyword_col (class 'color '(red 200 green 120 blue 200)))
 		)
 	)
+	(palette-load (mapcar (lambda (c) (cmt c '_to-16bit))
+		(list se:code_col se:line_col se:border_col se:bg_col se:cursor_col se:emph_col se:alert_col se:input_col
+			se:string_col se:comment_col se:number_col se:keyword_col)))
+)
+
+(defun se:init (sk)
+	(se:skin sk)
 
 	(defvar se:origin (cons 34 18))
 	(defvar se:txtpos (cons 0 0))
-	(defvar se:txtmax (cons 47 21))
+	(defvar se:txtmax (cons 46 21))
 	(defvar se:offset (cons 0 0))
 	(defvar se:scrpos (cons 0 0))
 	(defvar se:lastc nil)
 	(defvar se:funcname nil)
 	(defvar se:filename nil)
 	(defvar se:suffix nil)
-	(defvar se:buffer ())
-	(defvar se:curline "")
 	(defvar se:tscale 1)
 	(defvar se:leading (* 10 se:tscale))
 	(defvar se:cwidth (* 6 se:tscale))
-	(defvar se:openings ())
-	(defvar se:closings ())
 	(defvar se:lastmatch ())
 	(defvar se:match nil)
 	(defvar se:exit nil)
 
 	
-	(fill-screen)
-	(draw-line 32 17 32 240 (cmt se:border_col '_to-16bit))
-	(draw-line 0 239 320 239 (cmt se:border_col '_to-16bit))
-	(set-cursor 0 0)
-	(set-text-color (cmt se:bg_col '_to-16bit) (cmt se:cursor_col '_to-16bit))
-	(write-text "   touchscreen+h Help")
+	(fill-screen (palette 3))
+	(draw-line 32 17 32 240 (palette 2))
+	(draw-line 33 17 33 240 (palette 2))
+	(draw-line 0 239 320 239 (palette 2))
+	(screen-setup (car se:origin) (cdr se:origin) (1+ (car se:txtmax)) (1+ (cdr se:txtmax)))
+	(screen-scroll t)
+	(draw-text-run 0 0 (palette 3) (palette 4) "   touchscreen+h Help")
 )
 
 (defun se:cleanup ()
-	(makunbound 'se:buffer)
-	(makunbound 'se:openings)
-	(makunbound 'se:closings)
-	(makunbound 'se:curline)
+	(buffer-clear)
 	(gc)
 )
 
+(defun se:restore-cell (tpos gutter)
+	(screen-restore (- (car tpos) (car se:offset)) (- (cdr tpos) (cdr se:offset)) gutter)
+)
+
 (defun se:hide-cursor ()
 	(when se:lastmatch
-		(let ((spos nil) (bpos (car se:lastmatch)) (br (cdr se:lastmatch)))
-			(setf spos (se:calc-scrpos bpos))
-			(set-cursor (car spos) (cdr spos)) 
-			(set-text-color (cmt se:code_col '_to-16bit) (cmt se:bg_col '_to-16bit))
-			(write-text (string br))
-			(setf se:lastmatch nil)
-		)
+		(se:restore-cell se:lastmatch nil)
+		(setf se:lastmatch nil)
 	)
 	(when se:lastc 
-		(set-cursor (car se:scrpos) (cdr se:scrpos)) 
-		(set-text-color (cmt se:code_col '_to-16bit) (cmt se:bg_col '_to-16bit))
-		(write-text (string se:lastc))
-		(set-cursor 0 (cdr se:scrpos))
-		(set-text-color (cmt se:line_col '_to-16bit))
-		(write-text (string (1+ (cdr se:txtpos))))
+		(se:restore-cell se:txtpos t)
 	)
 )
 		
 (defun se:show-cursor (&optional forceb)
 	(let ((x (car se:txtpos))
 		  (y (cdr se:txtpos))
-		  (ox (car se:offset))
-		  (oy (cdr se:offset))
-		  (padx (car se:origin))
-		  (pady (cdr se:origin))
 		  (myc (code-char 32)))
-		(setf se:curline (nth y se:buffer))
 		(setf se:scrpos (se:calc-scrpos se:txtpos))
-		(set-cursor (car se:scrpos) (cdr se:scrpos))
-		(set-text-color (cmt se:code_col '_to-16bit) (cmt se:cursor_col '_to-16bit))
 		#| check if cursor is within line string or behind last char |#
-		(when (< x (length se:curline)) (setf myc (char se:curline x)))
+		(setf myc (or (buffer-char x y) myc))
 		(setf se:lastc myc)
 		(if forceb
 			(progn
@@ -170,91 +294,34 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 			)
 			(se:write-char (char-code myc))
 		)
-		(set-cursor 0 (cdr se:scrpos))
-		(set-text-color (cmt se:cursor_col '_to-16bit))
-		(write-text (string (1+ y)))
+		(draw-text-run 0 (cdr se:scrpos) (palette 4) (palette 3) (string (1+ y)))
 	)
 )
 
 (defun se:toggle-match ()
-	(keyboard-flush)
 	(if se:match
 		(progn
-			(setf se:match nil) (setf se:openings ()) (setf se:closings ())
-			(set-cursor 0 0)
-			(set-text-color (cmt se:bg_col '_to-16bit) (cmt se:cursor_col '_to-16bit))
-			(write-text "F1")
-			(keyboard-flush)
+			(setf se:match nil)
+			(draw-text-run 0 0 (palette 3) (palette 4) "F1")
 		)
 		(progn
 			(setf se:match t)
-			(set-cursor 0 0)
-			(set-text-color (cmt se:bg_col '_to-16bit) (cmt se:emph_col '_to-16bit))
-			(write-text "F1")
+			(draw-text-run 0 0 (palette 3) (palette 5) "F1")
 			(se:hide-cursor)
-			(se:map-brackets)
-			(keyboard-flush)
 			(se:show-cursor)
 		)
 	)
 )
 
 (defun se:checkbr ()
-	(keyboard-flush)
 	(se:hide-cursor)
-	(se:map-brackets t)
 	(se:show-cursor t)
-	(setf se:openings ())
-	(setf se:closings ())
 	(setf se:match nil)
-	(set-cursor 0 0)
-	(set-text-color (cmt se:bg_col '_to-16bit) (cmt se:cursor_col '_to-16bit))
-	(write-text "F1")
-	(keyboard-flush)
-)
-
-(defun se:map-brackets (&optional forcemp)
-	(when (or se:match forcemp)
-		(let ((myline "") (keys ()) (octr 0) (bl (length se:buffer)))
-			(dotimes (y bl)
-				(setf myline (nth y se:buffer))
-				(dotimes (x (length myline))
-					(when (equal (char-code (char myline x)) 40) (push (cons (cons x y) octr) se:openings) (push octr keys) (incf octr))
-					(when (equal (char-code (char myline x)) 41) (push (cons (cons x y) (if keys (pop keys) nil)) se:closings))
-				)
-			)
-		)
-	)
-)
-
-(defun se:find-closing-bracket ()
-	(let ((opentry (assoc* se:txtpos se:openings #'equal)) (clentry nil))
-		(if opentry
-			(progn
-				(setf clentry (reverse-assoc* (cdr opentry) se:closings #'equal))
-				(if clentry
-					clentry
-					nil
-				)
-			)
-			nil
-		)
-	)
+	(draw-text-run 0 0 (palette 3) (palette 4) "F1")
 )
 
-(defun se:find-opening-bracket ()
-	(let ((clentry (assoc* se:txtpos se:closings #'equal)) (opentry nil))
-		(if clentry
-			(progn
-				(setf opentry (reverse-assoc* (cdr clentry) se:openings #'equal))
-				(if opentry
-					opentry
-					nil
-				)
-			)
-			nil
-		)
-	)
+(defun se:find-partner ()
+	(bracket-partner (car se:txtpos) (cdr se:txtpos))
 )
 
 (defun se:in-window (pos)
@@ -313,314 +380,164 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 )
 
 (defun se:write-char (cc)
-	(let ((bpos nil) (spos nil))
-		(cond
-			((and (= cc 40) se:match)
-				(setf bpos (se:find-closing-bracket))
-				(when bpos
-					(when (se:in-window bpos)
-						(setf spos (se:calc-scrpos bpos))
-						(set-cursor (car spos) (cdr spos))
-						(set-text-color (cmt se:code_col '_to-16bit) (cmt se:emph_col '_to-16bit))
-						(write-text ")")
-						(setf se:lastmatch (cons bpos ")"))
-					)
-					(set-text-color (cmt se:code_col '_to-16bit) (cmt se:emph_col '_to-16bit))
-				)
-				(set-cursor (car se:scrpos) (cdr se:scrpos))
-				(write-text (string (code-char cc)))
-				(set-text-color (cmt se:code_col '_to-16bit) (cmt se:bg_col '_to-16bit))
-			)
-			((and (= cc 41) se:match)
-				(setf bpos (se:find-opening-bracket))
-				(when bpos
-					(when (se:in-window bpos)
-						(setf spos (se:calc-scrpos bpos))
-						(set-cursor (car spos) (cdr spos))
-						(set-text-color (cmt se:code_col '_to-16bit) (cmt se:emph_col '_to-16bit))
-						(write-text "(")
-						(setf se:lastmatch (cons bpos "("))
-					)
-					(set-text-color (cmt se:code_col '_to-16bit) (cmt se:emph_col '_to-16bit))
+	(let ((bpos nil) (spos nil) (pal 4))
+		(when (and se:match (or (= cc 40) (= cc 41)))
+			(setf bpos (se:find-partner))
+			(when bpos
+				(when (se:in-window bpos)
+					(setf spos (se:calc-scrpos bpos))
+					(draw-text-run (car spos) (cdr spos) (palette 0) (palette 5) (if (= cc 40) ")" "("))
+					(setf se:lastmatch bpos)
 				)
-				(set-cursor (car se:scrpos) (cdr se:scrpos))
-				(write-text (string (code-char cc)))
-				(set-text-color (cmt se:code_col '_to-16bit) (cmt se:bg_col '_to-16bit))
+				(setf pal 5)
 			)
-			(t (write-text (string (code-char cc))))
-		)
-	)
-)
-
-(defun se:disp-line (y)
-	(let ((ypos (+ (cdr se:origin) (* (- y (cdr se:offset)) se:leading))) (myl " "))
-		(when (nth y se:buffer) (setf myl (concatenate 'string (nth y se:buffer) myl)))
-		(set-text-color (cmt se:line_col '_to-16bit))
-		(set-cursor 0 ypos)
-		(write-text (string (1+ y)))
-
-		(set-cursor (car se:origin) ypos)
-		(set-text-color (cmt se:code_col '_to-16bit) (cmt se:bg_col '_to-16bit))
-		(when (> (length myl) (car se:offset))
-			(write-text (subseq myl (car se:offset) (min (length myl) (+ (car se:txtmax) (car se:offset) 1))))
 		)
+		(draw-text-run (car se:scrpos) (cdr se:scrpos) (palette 0) (palette pal) (code-char cc))
 	)
 )
 
 (defun se:show-text ()
-	(fill-rect 34 18 320 240 (cmt se:bg_col '_to-16bit))
-	(fill-rect 0 18 33 240 (cmt se:bg_col '_to-16bit))
-  (draw-line 33 17 33 240 (cmt se:border_col '_to-16bit))
-	(let ((i 0) (ymax (min (cdr se:txtmax) (- (length se:buffer) (cdr se:offset) 1))))
-		(loop
-			(se:disp-line (+ i (cdr se:offset)))
-			(when (= i ymax) (return))
-			(incf i)
-		)
-	)
+	(screen-refresh (car se:offset) (cdr se:offset))
 )
 
 (defun se:show-dir ()
 	(keyboard-flush)
 	(se:hide-cursor)
-	(fill-rect 34 18 320 240 (cmt se:bg_col '_to-16bit))
-	(fill-rect 0 18 33 240 (cmt se:bg_col '_to-16bit))
-	(set-text-color (cmt se:line_col '_to-16bit))
-	(let ((spos (se:calc-scrpos (cons 0 0))))
-		(set-cursor (car spos) (cdr spos))
-		(write-text "/")
-	)
-	(let ((dirbuf (dir2)))
-		(se:compile-dir dirbuf (cons 0 1))
-	)
-	(loop
-		(when (keyboard-get-key t) (return))
-	)
-	(keyboard-flush)
-	(se:show-text)
-	(se:show-cursor)
-)
-
-(defun se:compile-dir (mydir dpos)
-	(let ((spos nil))
+	(screen-overlay)
+	(let ((offset 0) (rows (cdr se:txtmax)) (entries nil) (key nil))
 		(loop
-			(when (null mydir) (return (cons (- (car dpos) 3) (cdr dpos))))
-			(let ((entry (pop mydir)))
-				(unless  (> (cdr dpos) (cdr se:txtmax))
-					(setf spos (se:calc-scrpos dpos))
-					(set-cursor (car spos) (cdr spos))
-					(incf (cdr dpos))
-					(cond 
-						((listp entry) (set-text-color (cmt se:code_col '_to-16bit))
-							(write-text (car entry)))
-						(t (set-text-color (cmt se:line_col '_to-16bit))
-							(write-text entry)
-							(setf dpos (se:compile-dir  (dir2 entry) (cons (+ 3 (car dpos)) (cdr dpos)))))
-					)
+			(fill-rect 34 18 320 240 (palette 3))
+			(fill-rect 0 18 33 240 (palette 3))
+			(set-text-color (palette 1))
+			(set-cursor (car se:origin) (cdr se:origin))
+			(write-text "/")
+			(setf entries (dir-walk "/" 3 offset rows))
+			(let ((y 1))
+				(dolist (entry entries)
+					(set-cursor (+ (car se:origin) (* 3 (first entry) se:cwidth)) (+ (cdr se:origin) (* y se:leading)))
+					(set-text-color (palette (if (third entry) 0 1)))
+					(write-text (second entry))
+					(incf y)
 				)
 			)
+			(setf key nil)
+			(loop
+				(setf key (keyboard-get-key nil t))
+				(when key (return))
+			)
+			(case key
+				((or 214 217 258) (when (= (length entries) rows) (incf offset rows)))
+				((or 211 218 259) (setf offset (max 0 (- offset rows))))
+				(t (return))
+			)
 		)
 	)
+	(keyboard-flush)
+	(screen-invalidate)
+	(se:show-text)
+	(se:show-cursor)
 )
 
 (defun se:flush-buffer ()
-	(keyboard-flush)
 	(when (se:alert "Flush buffer")
 		(se:hide-cursor)
-		(setq se:buffer (list ""))
+		(buffer-from-list (list ""))
 		(setf se:txtpos (cons 0 0))
 		(setf se:offset (cons 0 0))
 		(se:show-text)
-		(se:show-cursor)
-		(keyboard-flush))
+		(se:show-cursor))
 )
 
 (defun se:flush-line ()
-	(keyboard-flush)
 	(se:hide-cursor)
 	(let* ((x (car se:txtpos))
-	   (y (cdr se:txtpos))
-	   (myl se:curline)
-	   (firsthalf ""))
-		(progn
-			(setf firsthalf (subseq myl 0 x))
-			(setf (nth y se:buffer) firsthalf)
-			(setf se:curline (concatenate 'string (nth y se:buffer) " "))
-			(setf se:lastc nil)
-			(se:disp-line y)
-		)
+	   (y (cdr se:txtpos)))
+		(buffer-delete x y (- (buffer-line-length y) x))
+		(setf se:lastc nil)
 	)
-	(se:map-brackets)
 	(se:show-text)
 	(se:show-cursor)
-	(keyboard-flush)
 )
 
 (defun se:insert (newc)
 	(se:hide-cursor)
 	(let* ((x (car se:txtpos))
-		   (y (cdr se:txtpos))
-		   (myl se:curline)
-		   (firsthalf "")
-		   (scdhalf ""))
-		(setf firsthalf (subseq myl 0 x))
-		(setf scdhalf (subseq myl x (length myl)))
-		(setf (nth y se:buffer) (concatenate 'string firsthalf (string newc) scdhalf))
-		(incf (car se:txtpos))
-		(setf se:curline (nth y se:buffer))
+		   (y (cdr se:txtpos)))
+		(setf (car se:txtpos) (buffer-insert x y newc))
 		(setf se:lastc nil)
-		(if (> (car se:txtpos) (car se:txtmax)) (se:move-window) (se:disp-line y))
+		(se:move-window t)
+	)
+	(se:show-cursor)
+)
+
+(defun se:undo (&optional redo)
+	(se:hide-cursor)
+	(let ((pos (if redo (buffer-redo) (buffer-undo))))
+		(when pos
+			(setf se:txtpos pos)
+			(setf se:lastc nil)
+			(se:move-window t)
+		)
 	)
-	(se:map-brackets)
 	(se:show-cursor)
 )
 
 (defun se:tab ()
-	(keyboard-flush)
-		(se:insert #\032)
-		(se:insert #\032)
-		(se:insert #\032)
-		(se:insert #\032)
-	(keyboard-flush)
+	(se:insert #\032)
+	(se:insert #\032)
+	(se:insert #\032)
+	(se:insert #\032)
 )
 
 (defun se:enter ()
 	(se:hide-cursor)
 	(let* ((x (car se:txtpos))
-		   (y (cdr se:txtpos))
-		   (myl se:curline)
-		   (firsthalf "")
-		   (scdhalf "")
-		   (newl () ))
-		(setf firsthalf (subseq myl 0 x))
-		(setf scdhalf (subseq myl x (length myl)))
-		(dotimes (i y)
-			(push (nth i se:buffer) newl)
-		)
-		(push firsthalf newl)
-		(push scdhalf newl)
-		(dotimes (i (- (length se:buffer) (1+ y)))
-			(push (nth (+ i (1+ y)) se:buffer) newl)
-		)
-		(setf se:buffer (reverse newl))
+		   (y (cdr se:txtpos)))
+		(buffer-split-line x y)
 		(setf (car se:txtpos) 0)
 		(incf (cdr se:txtpos))
-		(setf se:curline (nth (1+ y) se:buffer))
 		(setf se:lastc nil)
 		(setf (car se:offset) 0)
 		(se:move-window t)
 	)
-	(se:map-brackets)
 	(se:show-cursor)
 )
 
 (defun se:delete ()
 	(se:hide-cursor)
 	(let* ((x (car se:txtpos))
-		   (y (cdr se:txtpos))
-		   (myl se:curline)
-		   (firsthalf "")
-		   (scdhalf ""))
+		   (y (cdr se:txtpos)))
 		(if (> x 0)
 			(progn
-				(setf firsthalf (subseq myl 0 (1- x)))
-				(setf scdhalf (subseq myl x (length myl)))
-				(setf (nth y se:buffer) (concatenate 'string firsthalf scdhalf))
-				(setf se:curline (concatenate 'string (nth y se:buffer) " "))
+				(buffer-delete (1- x) y)
 				(decf (car se:txtpos))
 				(setf se:lastc nil)
-				(se:disp-line y)
+				(se:move-window t)
 			)
 			(when (> y 0)
-				(setf scdhalf se:curline)
-				(setf se:buffer (remove y se:buffer))
+				(setf (car se:txtpos) (buffer-join-lines (1- y)))
 				(decf (cdr se:txtpos))
-				(decf y)
-				(setf se:curline (nth y se:buffer))
-				(setf firsthalf se:curline)
-				(if firsthalf
-					(progn
-						(setf (nth y se:buffer) (concatenate 'string firsthalf scdhalf))
-						(setf (car se:txtpos) (length firsthalf))
-					)
-					(progn
-						(setf (nth y se:buffer) scdhalf)
-						(setf (car se:txtpos) 0)
-					)
-				)
 				(se:move-window t)
 			)
 		)
 	)
-	(se:map-brackets)
 	(se:show-cursor)
 )
 
-(defun se:left ()
+(defun se:move (dx dy)
 	(se:hide-cursor)
-	(cond
-		#| xpos > 0 |#
-		((> (car se:txtpos) 0) 
-			(decf (car se:txtpos))
-			(se:move-window)
-		)
-		#| xpos == 0, but ypos > 0 |#
-		((> (cdr se:txtpos) 0)
-			(decf (cdr se:txtpos))
-			(setf (car se:txtpos) (length (nth (cdr se:txtpos) se:buffer)))
-			(se:move-window)
-		)
-	)
+	(setf se:txtpos (buffer-move (car se:txtpos) (cdr se:txtpos) dx dy))
+	(se:move-window)
 	(se:show-cursor)
 )
 
-(defun se:right ()
-	(se:hide-cursor)
-	(cond
-		#| xpos < eol |#
-		((< (car se:txtpos) (length se:curline)) 
-			(incf (car se:txtpos))
-			(se:move-window)
-		)
-		#| xpos == eol, but ypos < end of se:buffer |#
-		((< (cdr se:txtpos) (1- (length se:buffer)))
-			(incf (cdr se:txtpos))
-			(setf (car se:txtpos) 0)
-			(se:move-window)
-		)
-	)
-	(se:show-cursor) 
-)
+(defun se:left (&optional n) (se:move (- (or n 1)) 0))
 
-(defun se:up ()
-	(se:hide-cursor)
-	(cond
-		#| ypos > 0 |#
-		((> (cdr se:txtpos) 0) 
-			(decf (cdr se:txtpos))
-			(setf se:curline (nth (cdr se:txtpos) se:buffer))
-			(when (> (car se:txtpos) (length se:curline)) 
-				(setf (car se:txtpos) (length se:curline))
-			)
-			(se:move-window)
-		)
-	)
-	(se:show-cursor)
-)
+(defun se:right (&optional n) (se:move (or n 1) 0))
 
-(defun se:down ()
-	(se:hide-cursor)
-	(cond
-		#| ypos < length of se:buffer |#
-		((< (cdr se:txtpos) (1- (length se:buffer))) 
-			(incf (cdr se:txtpos))
-			(setf se:curline (nth (cdr se:txtpos) se:buffer))
-			(when (> (car se:txtpos) (1+ (length se:curline))) (setf (car se:txtpos) (length se:curline)))
-			(se:move-window)
-		)
-	)
-	(se:show-cursor)
-)
+(defun se:up (&optional n) (se:move 0 (- (or n 1))))
+
+(defun se:down (&optional n) (se:move 0 (or n 1)))
 
 (defun se:linestart ()
 	(se:hide-cursor)
@@ -631,24 +548,14 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 
 (defun se:lineend ()
 	(se:hide-cursor)
-	(setf (car se:txtpos) (length se:curline))
+	(setf (car se:txtpos) (buffer-line-length (cdr se:txtpos)))
 	(se:move-window)
 	(se:show-cursor)
 )
 
-(defun se:nextpage ()
-	(se:hide-cursor)
-	(setf (cdr se:txtpos) (min (1- (length se:buffer)) (+ (cdr se:txtpos) (cdr se:txtmax) 1)))
-	(se:move-window)
-	(se:show-cursor)
-)
+(defun se:nextpage (&optional n) (se:move 0 (* (or n 1) (1+ (cdr se:txtmax)))))
 
-(defun se:prevpage ()
-	(se:hide-cursor)
-	(setf (cdr se:txtpos) (max 0 (- (cdr se:txtpos) (cdr se:txtmax) 1)))
-	(se:move-window)
-	(se:show-cursor)
-)
+(defun se:prevpage (&optional n) (se:move 0 (- (* (or n 1) (1+ (cdr se:txtmax))))))
 
 (defun se:docstart ()
 	(se:hide-cursor)
@@ -658,11 +565,22 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 )
 
 (defun se:run ()
-	(let ((body "") (fname (se:input "Symbol name: " se:funcname 60)))
-		(mapc (lambda (x) (setf body (concatenate 'string body x))) se:buffer)
+	(let* ((fname (se:input "Symbol name: " se:funcname 60)) (sb (string-builder)) (body nil))
+		(unwind-protect
+			(progn
+				(when fname (string-builder-append sb "(defvar " fname " '"))
+				(dotimes (y (buffer-lines))
+					(string-builder-append sb (buffer-line y) #\Newline)
+				)
+				(when fname (string-builder-append sb ")"))
+				(setf body (string-builder-string sb))
+				(setf sb nil)
+			)
+			(when sb (string-builder-string sb))
+		)
 		(if fname
 			(when (se:alert (concatenate 'string "Bind code to symbol " fname " "))
-				(eval (read-from-string (concatenate 'string (format nil "(defvar ~a" fname) (format nil " '~a)" body))))
+				(eval (read-from-string body))
 				(se:msg "Done! Returning to REPL")
 				(delay 2000)
 				(se:clr-msg)
@@ -697,18 +615,12 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 			)
 		)
 		(unless (or (< (length fname) 1) (< (length suffix) 1) (not overwrite))
-			(with-sd-card (strm (concatenate 'string fname "." suffix) 2)
-				(dolist (line se:buffer)
-					(princ line strm)
-					(princ (code-char 10) strm)
-				)
+			(let ((written (sd-write-lines (concatenate 'string "/" fname "." suffix))))
+				(setf se:filename fname)
+				(setf se:suffix suffix)
+				(draw-text-run (* 32 se:cwidth) 0 (palette 0) (palette 4) (concatenate 'string "FILE: " fname "." suffix "       "))
+				(se:msg (format nil "~a bytes in ~a ms. Done!" (car written) (cdr written)))
 			)
-			(set-cursor (* 32 se:cwidth) 0)
-			(set-text-color (cmt se:code_col '_to-16bit) (cmt se:cursor_col '_to-16bit))
-			(setf se:filename fname)
-			(setf se:suffix suffix)
-			(write-text (concatenate 'string "FILE: " fname "." suffix "       "))
-			(se:msg "Done! Returning to editor.")
 			(delay 1000)
 			(se:clr-msg)
 		)
@@ -717,26 +629,14 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 
 (defun se:load ()
 	(when (se:alert "Discard buffer and load from SD")
-		(let ((fname (se:input "LOAD file name: " nil 8 t)) (suffix (se:input "Suffix: ." "CL" 3 t)) (line ""))
+		(let ((fname (se:input "LOAD file name: " nil 8 t)) (suffix (se:input "Suffix: ." "CL" 3 t)))
 			(unless (or (< (length fname) 1) (< (length suffix) 1) (not (sd-file-exists (concatenate 'string "/" fname "." suffix))))
-				(setq se:buffer ())
-				(with-sd-card (strm (concatenate 'string "/" fname "." suffix) 0)
-					(loop
-						(setf line (read-line strm))
-						(if line 
-							(push line se:buffer)
-							(return)
-						)
-					)
-				)
-				(setf se:buffer (reverse se:buffer))
+				(sd-read-lines (concatenate 'string "/" fname "." suffix))
+				(when (= (buffer-lines 0) 0) (buffer-add-line))
 				(se:hide-cursor)
-				(se:map-brackets t)
-				(set-cursor (* 36 se:cwidth) 0)
-				(set-text-color (cmt se:code_col '_to-16bit) (cmt se:cursor_col '_to-16bit))
 				(setf se:filename fname)
 				(setf se:suffix suffix)
-				(write-text (concatenate 'string "FILE: " fname "." suffix "       "))
+				(draw-text-run (* 36 se:cwidth) 0 (palette 0) (palette 4) (concatenate 'string "FILE: " fname "." suffix "       "))
 				(setf se:txtpos (cons 0 0))
 				(setf se:offset (cons 0 0))
 				(se:show-text)
@@ -764,12 +664,13 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 )
 
 (defun se:msg (mymsg &optional alert cursor)
+	(screen-overlay)
 	(if alert
-		(set-text-color (cmt se:alert_col '_to-16bit))
-		(set-text-color (cmt se:emph_col '_to-16bit))
+		(set-text-color (palette 6))
+		(set-text-color (palette 5))
 	)
-  (fill-rect 33 50 280 110 (cmt se:bg_col '_to-16bit))
-  (draw-rect 33 50 280 110 (cmt se:border_col '_to-16bit))
+  (fill-rect 33 50 280 110 (palette 3))
+  (draw-rect 33 50 280 110 (palette 2))
 	(let ((spos (se:calc-msgpos (cons 0 (floor (/ (cdr se:txtmax) 2))))))
 		;;(set-cursor (+ (car spos) 4) (+ (cdr spos) 4))
     (set-cursor (- (car spos) 2) (- (cdr spos) 2))
@@ -778,7 +679,7 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 	(when cursor
 		(setf cursor (max 0 cursor))
 		 (let ((spos (se:calc-msgpos (cons cursor (floor (/ (cdr se:txtmax) 2))))))
-			(set-text-color (cmt se:code_col '_to-16bit) (cmt se:emph_col '_to-16bit))
+			(set-text-color (palette 0) (palette 5))
 			;;(set-cursor (+ (car spos) 4) (+ (cdr spos) 4))
       (set-cursor (- (car spos) 2) (- (cdr spos) 2))
 			(write-text (subseq mymsg cursor (1+ cursor)))
@@ -845,12 +746,14 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 )
 
 (defun se:clr-msg ()
+  (screen-invalidate 50 160)
   (se:show-text)
 )
 
 (defun print-text-list (lst)
-  (fill-rect 0 18 320 218 (cmt se:bg_col '_to-16bit))
-  (draw-rect 0 18 320 218 (cmt se:border_col '_to-16bit))
+  (screen-overlay)
+  (fill-rect 0 18 320 218 (palette 3))
+  (draw-rect 0 18 320 218 (palette 2))
   (let ((spos (se:calc-msgpos (cons 4 0))))
 		(dotimes (x (length lst))
 			(setf spos (se:calc-msgpos (cons 0 x)))
@@ -865,6 +768,7 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
       "c - quit" 
       "n - new file"
       "k - delete line at cursor"
+      "z - undo, r - redo"
       "scroll left - cursor to SOL"
       "scroll right - cursor to EOL"
       "scroll up or down - page up or down"
@@ -908,69 +812,81 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
           ((= lk 218) (print-text-list (nth 0 help-lists )))
           (t (return))
         )))
-		(se:clr-msg)
+		(screen-invalidate)
+		(se:show-text)
 		(keyboard-flush)
 	)
 )
 
-(defun se:sedit (&optional myform myskin)
+(defun se:show-latency ()
+	(let ((us (perf-last)))
+		(when us
+			(draw-text-run 138 0 (palette 1) (palette 3) (format nil "~6a us" us))
+		)
+	)
+)
+
+(defun se:edit (&optional myform myskin)
 	(se:init myskin)
-	(let* ((lkd nil)
-		   (lku nil)
-		   (lastkey nil)
-		   (k_pr nil)
-		   (numline 0)
-		   (kdelay 500)
-		   (repcnt nil)
-		   (newkey nil)
-		   (krepeat nil))
+	(let* ((lastkey nil))
 			(if myform
 				(progn
 					(setf se:funcname (prin1-to-string myform)) 
-					(setq se:buffer (split-string-to-list (string #\Newline) (string (with-output-to-string (str) (pprint (eval myform) str)))) )
-					(set-cursor (* 32 se:cwidth) 0)
-					(set-text-color (cmt se:code_col '_to-16bit) (cmt se:cursor_col '_to-16bit))
-					(if (> (length se:funcname) 13)
-						(write-text (concatenate 'string "SYM: " (subseq se:funcname 0 10) "..."))
-						(write-text (concatenate 'string "SYM: " se:funcname))
+					(buffer-from-list (split-string-to-list (string #\Newline) (string (with-output-to-string (str) (pprint (eval myform) str)))))
+					(draw-text-run (* 32 se:cwidth) 0 (palette 0) (palette 4)
+						(if (> (length se:funcname) 13)
+							(concatenate 'string "SYM: " (subseq se:funcname 0 10) "...")
+							(concatenate 'string "SYM: " se:funcname)
+						)
 					)
 				)
-				(setq se:buffer (list ""))
+				(buffer-from-list (list ""))
 			)
-			(se:map-brackets)
-			(se:show-text)
+					(se:show-text)
 			(se:show-cursor)
-			(loop
-				(setf lastkey (keyboard-get-key))
-				(when lastkey 
-					(case lastkey
-						((or 1 210) (se:linestart))
-						((or 5 213) (se:lineend))
-						((or 3 17) (when (se:alert "Exit") (se:cleanup) (setf se:exit t)) (keyboard-flush) (setf lastkey nil))
-						((or 24 14 2) (se:flush-buffer) (setf lastkey nil))
-						((or 11 12) (se:flush-line) (setf lastkey nil))
-						(94 (se:docstart))
-						(211 (se:prevpage))
-						(214 (se:nextpage))
-						(194 (se:toggle-match) (setf lastkey nil))
-						(195 (se:checkbr) (setf lastkey nil))
-						(198 (se:run) (setf lastkey nil))
-						(202 (se:remove) (setf lastkey nil))
-						(203 (se:save) (setf lastkey nil))
-						(204 (se:load) (setf lastkey nil))
-						(205 (se:show-dir) (setf lastkey nil))
-						(216 (se:left))
-						(215 (se:right))
-						(218 (se:up))
-						(217 (se:down))
-						((or 13 10) (se:enter))
-            (16 (se:help))
-						(9 (se:tab) (setf lastkey nil))
-						((or 8 127) (se:delete))
-						(t (se:insert (code-char lastkey)))
+			(display-list t)
+			(unwind-protect
+				(loop
+					(setf lastkey (keyboard-get-key nil t))
+					(when lastkey 
+						(when se:perfline (se:show-latency))
+						(case lastkey
+							((or 1 210) (se:linestart))
+							((or 5 213) (se:lineend))
+							((or 3 17) (when (se:alert "Exit") (se:cleanup) (setf se:exit t)) (keyboard-flush) (setf lastkey nil))
+							((or 24 14 2) (se:flush-buffer) (setf lastkey nil))
+							((or 11 12) (se:flush-line) (setf lastkey nil))
+							(94 (se:docstart))
+							(211 (se:prevpage (input-steps)))
+							(214 (se:nextpage (input-steps)))
+							(258 (se:nextpage))
+							(259 (se:prevpage))
+							(194 (se:toggle-match) (setf lastkey nil))
+							(195 (se:checkbr) (setf lastkey nil))
+							(198 (se:run) (setf lastkey nil))
+							(26 (se:undo))
+							(25 (se:undo t))
+							(202 (se:remove) (setf lastkey nil))
+							(203 (se:save) (setf lastkey nil))
+							(204 (se:load) (setf lastkey nil))
+							(205 (se:show-dir) (setf lastkey nil))
+							(216 (se:left (input-steps)))
+							(215 (se:right (input-steps)))
+							(218 (se:up (input-steps)))
+							(217 (se:down (input-steps)))
+							((or 13 10) (se:enter))
+	            (16 (se:help))
+							(9 (se:tab) (setf lastkey nil))
+							((or 8 127) (se:delete))
+							(t (cond
+								((<= 32 lastkey 126) (se:insert (concatenate 'string (string (code-char lastkey)) (keyboard-get-text nil "^"))))
+								((< lastkey 256) (se:insert (code-char lastkey)))))
+						)
 					)
+					(when se:exit (display-list nil) (screen-scroll nil) (fill-screen) (return t))
 				)
-				(when se:exit (fill-screen) (return t))
+				(display-list nil)
+				(screen-scroll nil)
 			)
 	)
 	(keyboard-flush)
@@ -978,112 +894,6 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 )
 
 
-;
-; Helper functions
-;
-;
-(defun constrain (value mini maxi)
-  (min (max value mini) maxi)
-)
-
-(defun split-string-to-list (delim str)
-	(unless (or (eq str nil) (not (stringp str))) 
-		(let* ((start 0)
-          (end (search-str delim str))
-          (lst nil))
-			(loop
-        (if (eq end nil) 
-          (return (append lst (list (subseq str start))))
-				  (setq lst (append lst (list (subseq str start end)))))
-        (setq start (1+ end))
-        (setq end (search-str delim str start))
-      )
-    )
-  )
-)
-
-(defun char-list-to-string (clist)
-	(let ((str "")) 
-		(dolist (c clist) (setq str (concatenate 'string str c))) 
-		str
-	)
-)
-
-(defun to-hex-char (i)
-	(unless (equal i nil)
-		(let ((i (abs i))) 
-			(code-char (+ i (if (<= i 9) 48 55)) )
-		)
-	)
-)
-
-(defun byte-to-hexstr (i)
-	(unless (equal i nil)
-		(let ((i (abs i))) 
-		 (concatenate 'string (string (to-hex-char (ash i -4))) (string (to-hex-char (logand i 15))) ) 
-		)
-	)
-)
-
-(defun word-to-hexstr (i)
-	(unless (equal i nil)
-		(let ((i (abs i))) 
-		 (concatenate 'string (byte-to-hexstr (ash i -8)) (byte-to-hexstr (logand i 255))) 
-		)
-	)
-)
-
-(defun hexstr-to-int (s)
-	(read-from-string (concatenate 'string "#x" s))
-)
-
-(defun remove-if (fn lis)
-  (mapcan #'(lambda (item) (unless (funcall fn item) (list item))) lis)
- )
-
-(defun remove-if-not (fn lis)
-  (mapcan #'(lambda (item) (when (funcall fn item) (list item))) lis)
-)
-
-(defun remove_item (ele lis)
-	(remove-if (lambda (item) (equal ele item)) lis)
-)
-
-(defun remove (place lis)
-	(let ((newlis ()))
-		(dotimes (i place)
-			(push (pop lis) newlis)
-		)
-		(pop lis)
-		(dotimes (i (length lis))
-			(push (pop lis) newlis)
-		)
-		(reverse newlis)
-	)
-)
-
-(defun assoc* (a alist test)
-  (cond
-   ((null alist) nil)
-   ((funcall test a (caar alist)) (car alist))
-   (t (assoc* a (cdr alist) test))
-  )
-)
-
-(defun reverse-assoc* (a alist test)
-  (cond
-   ((null alist) nil)
-   ((funcall test a (cdar alist)) (caar alist))
-   (t (reverse-assoc* a (cdr alist) test))
-  )
-)
-
-(defun get-obj (aname anum)
-	(read-from-string (eval (concatenate 'string aname (string anum))))
-)
-
-
-
 ; 
 ; class color
 ;
@@ -1122,4 +932,4 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 	)
 )
 
-)lisplibrary";
+)lispeditor";
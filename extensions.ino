@@ -18,14 +18,283 @@ TouchDrvGT911 touch;
 #endif
 
 #define TDECK_TOUCH_INT     16
+#define TOUCH_HOLD_MS       60   // modifier stays held this long after the last touch report
 
 #define TDECK_TRACKBALL_UP 3
 #define TDECK_TRACKBALL_DOWN 15
 #define TDECK_TRACKBALL_LEFT 1
 #define TDECK_TRACKBALL_RIGHT 2
 
-volatile int ball_val = 0;
+// Performance counters
 
+/*
+  Each key keyboard-get-key returns opens a sample, and the next call closes it,
+  so a sample is the time the editor took to handle the key; a handler that waits
+  for another key ends its sample there. Conses are estimated from Freespace over
+  each sample: a fall is cells allocated, a rise means a garbage collection ran.
+  Display traffic is what the renderer here sends, not the core's drawing.
+*/
+
+#define PERF_BUCKETS 20    // log2 microsecond buckets; the last takes everything slower
+#define PERF_RECENT  128   // samples kept for the percentiles
+
+enum { PERF_REFRESH, PERF_HIGHLIGHT, PERF_BRACKET, PERF_SECTIONS };
+
+typedef struct {
+  uint32_t keys, gcs, conses;
+  uint32_t buckets[PERF_BUCKETS];
+  uint32_t recent[PERF_RECENT];
+  uint32_t last, max;
+  uint64_t section[PERF_SECTIONS];  // microseconds in each native section, over all samples
+  uint64_t pixels, displaybytes, sdread, sdwritten;
+  uint32_t start;
+  unsigned int free;
+  bool open;
+} perf_t;
+
+perf_t Perf;
+
+void perfalloc () {
+  if (Freespace < Perf.free) Perf.conses = Perf.conses + (Perf.free - Freespace);
+  else if (Freespace > Perf.free) Perf.gcs++;
+  Perf.free = Freespace;
+}
+
+void perfkeyend () {
+  if (!Perf.open) return;
+  uint32_t us = micros() - Perf.start;
+  int b = 0;
+  while (b < PERF_BUCKETS - 1 && (us>>b) != 0) b++;
+  Perf.buckets[b]++;
+  Perf.recent[Perf.keys % PERF_RECENT] = us;
+  Perf.keys++;
+  Perf.last = us;
+  Perf.max = max(Perf.max, us);
+  perfalloc();
+  Perf.open = false;
+}
+
+void perfkeystart () {
+  perfkeyend();
+  Perf.free = Freespace;
+  Perf.start = micros();
+  Perf.open = true;
+}
+
+void perfdisplay (uint32_t pixels, uint32_t bytes) {
+  Perf.pixels = Perf.pixels + pixels;
+  Perf.displaybytes = Perf.displaybytes + bytes;
+}
+
+int perfcompare (const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+object *perfnumber (uint64_t n) {
+  return number((n > INT_MAX) ? INT_MAX : (int)n);
+}
+
+/*
+  (perf-counters [reset])
+  Returns (keys last p50 p99 max refresh highlight bracket conses gcs pixels display-bytes
+  sd-read sd-written histogram); times are in microseconds, the percentiles are over the
+  last 128 keys, and the section times are totals. If reset is true the counters then restart.
+*/
+object *fn_PerfCounters (object *args, object *env) {
+  (void) env;
+  static uint32_t sorted[PERF_RECENT];
+  int n = min(Perf.keys, (uint32_t)PERF_RECENT);
+  memcpy(sorted, Perf.recent, n*sizeof(uint32_t));
+  qsort(sorted, n, sizeof(uint32_t), perfcompare);
+  object *histogram = nil;
+  for (int b = PERF_BUCKETS - 1; b >= 0; b--) histogram = cons(number(Perf.buckets[b]), histogram);
+  protect(histogram);
+  uint64_t values[] = { Perf.keys, Perf.last, n ? sorted[n/2] : 0, n ? sorted[(n*99)/100] : 0, Perf.max,
+    Perf.section[PERF_REFRESH], Perf.section[PERF_HIGHLIGHT], Perf.section[PERF_BRACKET], Perf.conses, Perf.gcs,
+    Perf.pixels, Perf.displaybytes, Perf.sdread, Perf.sdwritten };
+  object *result = cons(histogram, nil);
+  unprotect();
+  for (int i = arraysize(values) - 1; i >= 0; i--) result = cons(perfnumber(values[i]), result);
+  if (args != NULL && first(args) != nil) {
+    memset(&Perf, 0, sizeof(Perf));
+  }
+  return result;
+}
+
+/*
+  (perf-last)
+  Returns the microseconds taken by the last key handled, or nil if there hasn't been one.
+*/
+object *fn_PerfLast (object *args, object *env) {
+  (void) args, (void) env;
+  return Perf.keys ? perfnumber(Perf.last) : nil;
+}
+
+// Input event queues
+
+/*
+  Single-producer, single-consumer rings of timestamped input events. The
+  trackball interrupts are the only producer of InputIsr, and the keyboard poll
+  is the only producer of InputPoll, so neither needs a lock; keyboard-get-key
+  and input-events consume both in time order.
+*/
+
+#define INPUT_QUEUE 64   // a power of 2
+
+typedef struct {
+  uint32_t time;
+  uint16_t code;          // key code, or a GESTURE_ code
+  int16_t x, y, value;    // gestures only
+} inputevent_t;
+
+typedef struct {
+  inputevent_t events[INPUT_QUEUE];
+  volatile uint8_t head;  // written by the producer
+  volatile uint8_t tail;  // written by the consumer
+} inputqueue_t;
+
+inputqueue_t InputIsr, InputPoll;
+
+bool IRAM_ATTR inputpush (inputqueue_t *q, uint16_t code) {
+  uint8_t head = q->head;
+  if ((uint8_t)(head - q->tail) >= INPUT_QUEUE) return false; // full, drop the event
+  inputevent_t *event = &q->events[head & (INPUT_QUEUE - 1)];
+  event->time = millis();
+  event->code = code;
+  event->x = event->y = event->value = 0;
+  q->head = head + 1;
+  return true;
+}
+
+// Gestures are recognised in touchpoll(), so they share the keyboard poll's queue
+void inputgesture (uint16_t code, int x, int y, int value) {
+  uint8_t head = InputPoll.head;
+  if (!inputpush(&InputPoll, code)) return;
+  inputevent_t *event = &InputPoll.events[head & (INPUT_QUEUE - 1)];
+  event->x = x; event->y = y; event->value = min(value, 32767);
+}
+
+inputevent_t *inputpeek (inputqueue_t *q) {
+  if (q->head == q->tail) return NULL;
+  return &q->events[q->tail & (INPUT_QUEUE - 1)];
+}
+
+// Touch state
+
+/*
+  The GT911 pulses its INT line each time it has a new report, so the interrupt
+  only flags that a read is due. touchpoll() then does a single getPoint, and
+  only when flagged, keeping the frame in a short history and feeding the
+  gesture recogniser; the modifier state is a timestamp check after that.
+*/
+
+#define TOUCH_FRAMES    16
+#define TOUCH_POINTS    5
+#define TAP_SLOP        10   // pixels a tap may wander
+#define SWIPE_MIN       40   // pixels a swipe must travel
+#define LONGPRESS_MS    600
+
+enum gesture { GESTURE_TAP = 256, GESTURE_LONGPRESS, GESTURE_SWIPE_UP, GESTURE_SWIPE_DOWN,
+  GESTURE_SWIPE_LEFT, GESTURE_SWIPE_RIGHT, GESTURE_TWO_FINGER };
+
+typedef struct {
+  uint32_t time;
+  uint8_t count;
+  int16_t x[TOUCH_POINTS], y[TOUCH_POINTS];
+} touchframe_t;
+
+typedef struct {
+  bool active, moved, longpress, modifier;  // modifier: a key was typed while touched
+  uint8_t fingers;
+  uint32_t start;
+  int16_t x0, y0, x, y;
+} gesture_t;
+
+volatile bool TouchPending = false;
+uint32_t TouchLast = 0;   // millis() of the last report with a finger down
+bool TouchSeen = false;
+touchframe_t TouchFrames[TOUCH_FRAMES];
+uint8_t TouchFrameNext = 0, TouchFrameCount = 0;
+gesture_t Gesture;
+
+void IRAM_ATTR ISR_touch () {
+  TouchPending = true;
+}
+
+void gesturetouch (touchframe_t *frame) {
+  if (!Gesture.active) {
+    Gesture.active = true; Gesture.moved = false; Gesture.longpress = false; Gesture.modifier = false;
+    Gesture.fingers = 0; Gesture.start = frame->time;
+    Gesture.x0 = frame->x[0]; Gesture.y0 = frame->y[0];
+  }
+  Gesture.fingers = max(Gesture.fingers, frame->count);
+  Gesture.x = frame->x[0]; Gesture.y = frame->y[0];
+  if (abs(Gesture.x - Gesture.x0) > TAP_SLOP || abs(Gesture.y - Gesture.y0) > TAP_SLOP) Gesture.moved = true;
+}
+
+void gesturerelease () {
+  if (!Gesture.active) return;
+  Gesture.active = false;
+  int dx = Gesture.x - Gesture.x0, dy = Gesture.y - Gesture.y0;
+  int dt = max((int)(TouchLast - Gesture.start), 1);
+  if (Gesture.modifier) return;
+  else if (Gesture.fingers >= 2) inputgesture(GESTURE_TWO_FINGER, Gesture.x0, Gesture.y0, dt);
+  else if (Gesture.longpress) return;
+  else if (abs(dy) >= SWIPE_MIN && abs(dy) >= abs(dx))
+    inputgesture(dy < 0 ? GESTURE_SWIPE_UP : GESTURE_SWIPE_DOWN, Gesture.x0, Gesture.y0, abs(dy)*1000/dt);
+  else if (abs(dx) >= SWIPE_MIN)
+    inputgesture(dx < 0 ? GESTURE_SWIPE_LEFT : GESTURE_SWIPE_RIGHT, Gesture.x0, Gesture.y0, abs(dx)*1000/dt);
+  else if (!Gesture.moved) inputgesture(GESTURE_TAP, Gesture.x, Gesture.y, dt);
+}
+
+void touchpoll () {
+  #if defined (touchscreen)
+  uint32_t now = millis();
+  if (TouchPending) {
+    TouchPending = false;
+    touchframe_t *frame = &TouchFrames[TouchFrameNext];
+    frame->count = touch.getPoint(frame->x, frame->y, min((int)touch.getSupportTouchPoint(), TOUCH_POINTS));
+    frame->time = now;
+    TouchFrameNext = (TouchFrameNext + 1) % TOUCH_FRAMES;
+    if (TouchFrameCount < TOUCH_FRAMES) TouchFrameCount++;
+    if (frame->count > 0) {
+      TouchLast = now;
+      TouchSeen = true;
+      gesturetouch(frame);
+    } else gesturerelease();
+  }
+  if (Gesture.active) {
+    // A missed release report shows up as silence on the INT line
+    if (now - TouchLast >= TOUCH_HOLD_MS) gesturerelease();
+    else if (!Gesture.longpress && !Gesture.moved && Gesture.fingers == 1 && now - Gesture.start >= LONGPRESS_MS) {
+      Gesture.longpress = true;
+      inputgesture(GESTURE_LONGPRESS, Gesture.x, Gesture.y, now - Gesture.start);
+    }
+  }
+  #endif
+}
+
+// Debounced "modifier held" flag; costs an I2C read only when the GT911 has signalled a report
+bool isScreenTouched(){
+  touchpoll();
+  return TouchSeen && (millis() - TouchLast < TOUCH_HOLD_MS);
+}
+
+// The frame n reports back, or NULL
+touchframe_t *touchframe (int n) {
+  if (n >= TouchFrameCount) return NULL;
+  return &TouchFrames[(TouchFrameNext + TOUCH_FRAMES - 1 - n) % TOUCH_FRAMES];
+}
+
+object *touchpoints (touchframe_t *frame) {
+  object *result = nil;
+  //start from the end of the list so we dont have to reverse it
+  for (int i = frame->count; i > 0; --i) {
+    result = cons(cons(number(frame->x[i-1]), number(frame->y[i-1])), result);
+  }
+  return result;
+}
 
 void initTouch(){
   #if defined (touchscreen)
@@ -44,28 +313,53 @@ void initTouch(){
   touch.setSwapXY(true);
   // Set mirror xy
   touch.setMirrorXY(false, true);
+  attachInterrupt(digitalPinToInterrupt(TDECK_TOUCH_INT), ISR_touch, FALLING);
   #endif
 }
 
-void ISR_trackball_up(){
-  //if(ball_val == 0){
-    ball_val = 218;
-  //}
+// Trackball
+
+/*
+  Each tick of the trackball is one step, or more if it comes soon after the last
+  tick in the same direction, so spinning the ball fast goes further. A tick in the
+  same direction as the newest queued event is added to it instead of queued, as
+  long as that event isn't the one being read, so a long spin can't fill the queue.
+  Trackball events keep their ticks in x and their steps in value.
+*/
+
+#define TRACKBALL_FAST_MS  15   // a tick this soon after the last counts 4 steps
+#define TRACKBALL_QUICK_MS 40   // and this soon, 2
+
+volatile uint32_t TrackballLast[4];  // time of the last tick in each direction
+
+void IRAM_ATTR trackballtick (int dir, uint16_t code) {
+  uint32_t now = millis(), gap = now - TrackballLast[dir];
+  TrackballLast[dir] = now;
+  int steps = (gap < TRACKBALL_FAST_MS) ? 4 : (gap < TRACKBALL_QUICK_MS) ? 2 : 1;
+  uint8_t head = InputIsr.head;
+  inputevent_t *last = &InputIsr.events[(uint8_t)(head - 1) & (INPUT_QUEUE - 1)];
+  if ((uint8_t)(head - InputIsr.tail) >= 2 && last->code == code) {
+    last->x = min(last->x + 1, 32767);
+    last->value = min(last->value + steps, 32767);
+    return;
+  }
+  if (!inputpush(&InputIsr, code)) return;
+  inputevent_t *event = &InputIsr.events[head & (INPUT_QUEUE - 1)];
+  event->x = 1;
+  event->value = steps;
+}
+
+void IRAM_ATTR ISR_trackball_up(){
+  trackballtick(0, 218);
 }
-void ISR_trackball_down(){
-  //if(ball_val == 0){
-    ball_val = 217;
-  //}
+void IRAM_ATTR ISR_trackball_down(){
+  trackballtick(1, 217);
 }
-void ISR_trackball_left(){
-  //if(ball_val == 0){
-    ball_val = 216;
-  //}
+void IRAM_ATTR ISR_trackball_left(){
+  trackballtick(2, 216);
 }
-void ISR_trackball_right (){
-  //if(ball_val == 0){
-    ball_val = 215;
-  //}
+void IRAM_ATTR ISR_trackball_right(){
+  trackballtick(3, 215);
 }
 void inittrackball(){
   pinMode(TDECK_TRACKBALL_UP, INPUT_PULLUP);
@@ -79,47 +373,38 @@ void inittrackball(){
 }
 
 object *fn_get_touch_points (object *args, object *env) {
+  (void) args, (void) env;
   #if defined(touchscreen)
-  int16_t x[5], y[5];
-  uint8_t touched = 0;
-  object *result = nil;
-  do {
-    touched = touch.getPoint(x, y, touch.getSupportTouchPoint());
-    if (touched > 0) {
-      //start from the end of the list so we dont have to reverse it
-      for (int i = touched; i > 0; --i) {
-        result = cons(cons(number(x[i-1]), number(y[i-1])), result);
-      }
-    }
-  } while(touch.isPressed());
-  return result;
+  touchpoll();
+  touchframe_t *frame = touchframe(0);
+  if (frame == NULL || !isScreenTouched()) return nil;
+  // The newest frame may be a release report; use the last one with points
+  int n = 0;
+  while (frame != NULL && frame->count == 0) frame = touchframe(++n);
+  return (frame != NULL) ? touchpoints(frame) : nil;
 
   #else
   return nil;
   #endif
 }
 
-bool isScreenTouched(){
-  bool received_touch = false;
-  //clear any previous readings since it buffers those
-  do {
-    int16_t x[5], y[5];
-    uint8_t touched = touch.getPoint(x, y, touch.getSupportTouchPoint());
-  } while(touch.isPressed());
-
-  // touch.ispressed() will trigger like 5 times if you press it once so we have to loop through it and get the touchpoints
-  do {
-    int16_t x[5], y[5];
-    uint8_t touched = touch.getPoint(x, y, touch.getSupportTouchPoint());
-    if (touched > 0) {
-      received_touch = true;
-    }
-  } while(touch.isPressed());
-
-  return received_touch;
+/*
+  (touch-history)
+  Returns the recent touch frames, oldest first, each as (milliseconds (x . y) ...).
+*/
+object *fn_TouchHistory (object *args, object *env) {
+  (void) args, (void) env;
+  object *result = nil;
+  #if defined(touchscreen)
+  touchpoll();
+  for (int n = 0; n < TouchFrameCount; n++) {
+    touchframe_t *frame = touchframe(n);
+    result = cons(cons(number(frame->time), touchpoints(frame)), result);
+  }
+  #endif
+  return result;
 }
 
-
 // T-Deck extras
 char touchKeyModEditor(char temp){
   #if defined (touchscreen)
@@ -147,6 +432,8 @@ char touchKeyModEditor(char temp){
     c --- quit editor and return to REPL
     n --- discard current text buffer (i.e. new file)
     l --- delete line starting at cursor position
+    z --- undo
+    r --- redo
     trackball left --- move cursor to start of line
     trackball right --- move cursor to end of line
     ^ --- move cursor to beginning of buffer
@@ -190,6 +477,8 @@ char touchKeyModEditor(char temp){
     else if (temp == 'i') return (char)205; //show dir
     else if (temp == '1') return (char)194; //toggle bracket
     else if (temp == '2') return (char)195; //highlight
+    else if (temp == 'z') return (char)26;  //undo
+    else if (temp == 'r') return (char)25;  //redo
 
   }
   #else
@@ -199,194 +488,2711 @@ char touchKeyModEditor(char temp){
   return temp;
 }
 
-object *fn_KeyboardGetKey (object *args, object *env) {
-  (void) env, (void) args;
+// Read the keyboard and queue any key pressed
+void inputpoll () {
+  touchpoll();
   Wire1.requestFrom(0x55, 1);
   if (Wire1.available()){
     char temp = Wire1.read();
     if ((temp != 0) && (temp !=255)){
-      temp = touchKeyModEditor(temp);
-      //Serial.println((int)temp);
-      return number(temp);
+      inputpush(&InputPoll, touchKeyModEditor(temp));
+      if (Gesture.active) Gesture.modifier = true;
     }
   }
-  if(ball_val != 0){
-    int temp = ball_val;
-    ball_val = 0;
-    if (isScreenTouched()) {
-      // ((or 1 210) (se:linestart))
-      // ((or 5 213) (se:lineend))
-      // (211 (se:prevpage))
-      // (214 (se:nextpage))
-      switch(temp){
-        case 218: temp = 211; break; //up
-        case 217: temp = 214; break; //down
-        case 216: temp = 210; break; //left
-        case 215: temp = 213; break; //right
-      }
+}
+
+int InputSteps = 1;  // steps the last event taken adds up to
+
+#define INPUT_BATCH_CHARS 64   // typeahead taken at once by keyboard-get-text
+#define INPUT_BATCH_MS    50   // and the longest it reads for, so the screen keeps up
+
+/*
+  Take the oldest event from either queue; returns false if both are empty. Trackball
+  events in the same direction are merged up to the next key, and InputSteps is set to
+  their steps, or to their ticks if the screen is touched, as page moves don't speed up.
+*/
+bool inputnext (inputevent_t *event) {
+  inputevent_t *ball = inputpeek(&InputIsr), *key = inputpeek(&InputPoll), *next;
+  if (ball == NULL && key == NULL) return false;
+  if (key != NULL && (ball == NULL || (int32_t)(key->time - ball->time) <= 0)) {
+    *event = *key;
+    InputPoll.tail++;
+    InputSteps = 1;
+    return true;
+  }
+  *event = *ball;
+  InputIsr.tail++;
+  while ((next = inputpeek(&InputIsr)) != NULL && next->code == event->code &&
+    (key == NULL || (int32_t)(key->time - next->time) > 0)) {
+    event->x = min(event->x + next->x, 32767);
+    event->value = min(event->value + next->value, 32767);
+    InputIsr.tail++;
+  }
+  InputSteps = event->value;
+  if (isScreenTouched()) {
+    InputSteps = event->x;
+    // ((or 1 210) (se:linestart))
+    // ((or 5 213) (se:lineend))
+    // (211 (se:prevpage))
+    // (214 (se:nextpage))
+    switch(event->code){
+      case 218: event->code = 211; break; //up
+      case 217: event->code = 214; break; //down
+      case 216: event->code = 210; break; //left
+      case 215: event->code = 213; break; //right
     }
-    return number(temp);
   }
-  return nil;
+  return true;
 }
 
+#if defined(gfxsupport)
+int displayflush ();
+#endif
+
 /*
-  (keyboard-flush)
-  Discard missing key up/down events.
+  (keyboard-get-key [pressed [gestures]])
+  Returns the oldest key or trackball event, or nil. Gestures share the queue, and
+  are skipped unless gestures is true, so a finger lifted after a touch+key command
+  can't answer the prompt the command opens.
 */
-object *fn_KeyboardFlush (object *args, object *env) {
-  (void) args, (void) env;
-  return nil;
+object *fn_KeyboardGetKey (object *args, object *env) {
+  (void) env;
+  bool gestures = (args != NULL && cdr(args) != NULL && second(args) != nil);
+  inputevent_t event;
+  #if defined(gfxsupport)
+  displayflush();
+  #endif
+  inputpoll();
+  perfkeyend();
+  do {
+    if (!inputnext(&event)) return nil;
+  } while (event.code >= GESTURE_TAP && !gestures);
+  perfkeystart();
+  return number(event.code);
 }
 
+/*
+  (keyboard-get-text [max] [stop])
+  Takes the printable keys queued after the one keyboard-get-key last returned, up to
+  max characters or INPUT_BATCH_MS of reading, and returns them as a string. Stops at
+  any other key, a character in the string stop, or a trackball event, which are left
+  for keyboard-get-key; stop is for the printable keys the caller uses as commands.
+*/
+object *fn_KeyboardGetText (object *args, object *env) {
+  (void) env;
+  int max = INPUT_BATCH_CHARS;
+  char stop[33] = "";
+  if (args != NULL) {
+    if (first(args) != nil) max = checkinteger(first(args));
+    if (cdr(args) != NULL) cstring(checkstring(second(args)), stop, sizeof(stop));
+  }
+  object *obj = newstring();
+  object *tail = obj;
+  uint32_t start = millis();
+  while (max-- > 0 && millis() - start < INPUT_BATCH_MS) {
+    inputpoll();
+    inputevent_t *key = inputpeek(&InputPoll), *ball = inputpeek(&InputIsr);
+    if (key == NULL || key->code < 32 || key->code > 126 || strchr(stop, key->code)) break;
+    if (ball != NULL && (int32_t)(ball->time - key->time) < 0) break;
+    buildstring(key->code, &tail);
+    InputPoll.tail++;
+  }
+  return obj;
+}
 
+/*
+  (input-steps)
+  Returns the steps the last event from keyboard-get-key adds up to: 1 for a key, and
+  for the trackball its ticks, with quick ones counting extra unless the screen is touched.
+*/
+object *fn_InputSteps (object *args, object *env) {
+  (void) args, (void) env;
+  return number(InputSteps);
+}
 
-object *fn_searchstr (object *args, object *env) {
+/*
+  (input-events [max])
+  Returns a list of the queued input events, oldest first. Each is (code milliseconds),
+  or (code milliseconds x y value) for a gesture.
+*/
+object *fn_InputEvents (object *args, object *env) {
   (void) env;
-  
-  int startpos = 0;
-  object *pattern = first(args);
-  object *target = second(args);
-  args = cddr(args);
-  if (pattern == NULL) return number(0);
-  else if (target == NULL) return nil;
-  if (args != NULL) startpos = checkinteger(car(args));
-  
-if (stringp(pattern) && stringp(target)) {
-    int l = stringlength(target);
-    int m = stringlength(pattern);
-    if (startpos > l) error2(indexrange);
-    for (int i = startpos; i <= l-m; i++) {
-      int j = 0;
-      while (j < m && nthchar(target, i+j) == nthchar(pattern, j)) j++;
-      if (j == m) return number(i);
-    }
-    return nil;
-  } else error2("arguments are not both lists or strings");
-  return nil;
+  int max = (args != NULL) ? checkinteger(first(args)) : 2*INPUT_QUEUE;
+  inputevent_t event;
+  object *result = cons(NULL, NULL);
+  object *ptr = result;
+  inputpoll();
+  while (max-- > 0 && inputnext(&event)) {
+    object *item = nil;
+    if (event.code >= GESTURE_TAP) item = cons(number(event.x), cons(number(event.y), cons(number(event.value), nil)));
+    cdr(ptr) = cons(cons(number(event.code), cons(number(event.time), item)), NULL);
+    ptr = cdr(ptr);
+  }
+  return cdr(result);
 }
 
-#if defined sdcardsupport
 /*
-  (sd-file-exists filename)
-  Returns t if filename exists on SD card, otherwise nil.
+  (keyboard-flush)
+  Discards the keys waiting in the keyboard controller and every queued key, trackball
+  and gesture event.
 */
-object *fn_SDFileExists (object *args, object *env) {
+object *fn_KeyboardFlush (object *args, object *env) {
   (void) args, (void) env;
+  for (int i = 0; i < INPUT_QUEUE; i++) {
+    uint8_t head = InputPoll.head;
+    inputpoll();
+    if (InputPoll.head == head) break;
+  }
+  InputPoll.tail = InputPoll.head;
+  InputIsr.tail = InputIsr.head;
+  return nil;
+}
 
-  SD.begin(TDECK_SDCARD_CS);
 
-  int slength = stringlength(checkstring(first(args)))+1;
-  char *fnbuf = (char*)malloc(slength);
-  cstring(first(args), fnbuf, slength);
+// Text buffer
 
-  if (SD.exists(fnbuf)) {
-    return tee;
-  }
-  else {
-    return nil;
-  }
+/*
+  Line store for the screen editor. The line table is a gap buffer, so splitting
+  and joining lines at the cursor only moves the gap, and each line is a growable
+  char array, so an edit within a line is a memmove of the rest of that line.
+  None of this lives in the Lisp workspace, so editing creates no garbage.
+*/
+
+typedef struct {
+  char *text;
+  uint16_t len;
+  uint16_t cap;
+  int16_t delta;     // change in bracket depth over the line
+  int16_t mindepth;  // lowest bracket depth in the line, relative to its start
+  uint8_t endstate;  // lexer state at the end of the line
+} textline_t;
+
+textline_t *TextLines = NULL;
+int TextCap = 0;       // slots in the line table
+int TextGapStart = 0;  // first slot of the gap
+int TextGapEnd = 0;    // first slot after the gap
+bool TextLoading = false;  // lines are still to come from a file
+bool TextOpen = false;     // the last line is still being read
+bool TextIncomplete = false;  // reading the file failed part way, so the buffer mustn't be saved over it
+
+#define TEXT_BLOCK      2048
+#define TEXT_LOADAHEAD  64    // lines read beyond the last one asked for
+
+void textload (int upto);
+void textstopload ();
+void journalreset ();
+
+int textcount () {
+  return TextCap - (TextGapEnd - TextGapStart);
+}
+
+textline_t *textline (int y) {
+  if (y >= TextGapStart) y = y + (TextGapEnd - TextGapStart);
+  return &TextLines[y];
+}
+
+void textmovegap (int y) {
+  int gap = TextGapEnd - TextGapStart;
+  if (y < TextGapStart) memmove(&TextLines[y + gap], &TextLines[y], (TextGapStart - y) * sizeof(textline_t));
+  else if (y > TextGapStart) memmove(&TextLines[TextGapStart], &TextLines[TextGapEnd], (y - TextGapStart) * sizeof(textline_t));
+  TextGapStart = y;
+  TextGapEnd = y + gap;
+}
+
+void textgrowtable () {
+  int newcap = (TextCap == 0) ? 64 : TextCap * 2;
+  textline_t *lines = (textline_t *)realloc(TextLines, newcap * sizeof(textline_t));
+  if (lines == NULL) error2("not enough memory for text buffer");
+  int after = TextCap - TextGapEnd;
+  memmove(&lines[newcap - after], &lines[TextGapEnd], after * sizeof(textline_t));
+  TextLines = lines;
+  TextGapEnd = newcap - after;
+  TextCap = newcap;
 }
 
+// Lisp lexer and bracket index
+
 /*
-  (sd-file-remove filename)
-  Returns t if filename exists on SD card, otherwise nil.
+  Each line keeps the lexer state at its end, so a line can be lexed on its own
+  from the state left by the line before. Brackets inside strings, ; comments,
+  #| |# comments and character literals such as #\( are not counted.
+
+  Each line also keeps its net bracket depth change and the lowest depth it
+  reaches. A segment tree over these answers "where does the depth first drop
+  to d" in O(log n) lines, and only the line containing the partner is scanned.
 */
-object *fn_SDFileRemove (object *args, object *env) {
-  (void) args, (void) env;
 
-  SD.begin(TDECK_SDCARD_CS);
-  int slength = stringlength(checkstring(first(args)))+1;
-  char *fnbuf = (char*)malloc(slength);
-  cstring(first(args), fnbuf, slength);
+#define LEX_STRING   0x01  // inside "..."
+#define LEX_LINECMT  0x02  // after ; until the end of the line
+#define LEX_SKIP     0x0C  // characters still to skip, times 4
+#define LEX_SKIPONE  0x04
+#define LEX_BLOCK    0xF0  // #| |# nesting depth, times 16
+#define LEX_BLOCKONE 0x10
 
-  if (SD.exists(fnbuf)) {
-    SD.remove(fnbuf);
-    return tee;
-  }
-  else {
-    return nil;
-  }
+enum { TOK_CODE, TOK_OPEN, TOK_CLOSE, TOK_STRING, TOK_COMMENT, TOK_CHAR };
+
+int *BracketSum = NULL;  // segment tree: net depth change of each node
+int *BracketMin = NULL;  // segment tree: lowest depth in each node, relative to its start
+int BracketSize = 0;     // leaves in the tree, a power of 2
+bool BracketStale = true;
+
+// Classify character i of text, and advance the lexer state past it
+int lexchar (uint8_t *state, const char *text, int len, int i) {
+  uint8_t st = *state;
+  char c = text[i];
+  char next = (i + 1 < len) ? text[i + 1] : 0;
+  int tok;
+  if (st & LEX_SKIP) {
+    st = st - LEX_SKIPONE;
+    tok = (st & LEX_STRING) ? TOK_STRING : (st & (LEX_BLOCK | LEX_LINECMT)) ? TOK_COMMENT : TOK_CHAR;
+    if (tok == TOK_CHAR && c == '#' && i > 0 && text[i - 1] == '|') tok = TOK_COMMENT; // the end of |#
+  } else if (st & LEX_LINECMT) {
+    tok = TOK_COMMENT;
+  } else if (st & LEX_BLOCK) {
+    if (c == '|' && next == '#') st = (st - LEX_BLOCKONE) | LEX_SKIPONE;
+    else if (c == '#' && next == '|' && (st & LEX_BLOCK) != LEX_BLOCK) st = (st + LEX_BLOCKONE) | LEX_SKIPONE;
+    tok = TOK_COMMENT;
+  } else if (st & LEX_STRING) {
+    if (c == '\\') st = st | LEX_SKIPONE;
+    else if (c == '"') st = st & ~LEX_STRING;
+    tok = TOK_STRING;
+  } else if (c == '"') {
+    st = st | LEX_STRING; tok = TOK_STRING;
+  } else if (c == ';') {
+    st = st | LEX_LINECMT; tok = TOK_COMMENT;
+  } else if (c == '#' && next == '|') {
+    st = st + LEX_BLOCKONE + LEX_SKIPONE; tok = TOK_COMMENT;
+  } else if (c == '#' && next == '\\') {
+    st = st + 2*LEX_SKIPONE; tok = TOK_CHAR;
+  } else if (c == '(') tok = TOK_OPEN;
+  else if (c == ')') tok = TOK_CLOSE;
+  else tok = TOK_CODE;
+  *state = st;
+  return tok;
 }
 
-object *fn_directory2(object *args, object *env) {
-  (void) env;
-  char *sd_path_buf = NULL; 
+uint8_t textstartstate (int y) {
+  return (y == 0) ? 0 : textline(y - 1)->endstate;
+}
 
-  SDBegin();
-  File root; 
-  object *result = cons(NULL, NULL);
-  object *ptr = result;
-  
-  if (args != NULL) {
-    object *arg1 = checkstring(first(args));
-    int len = stringlength(arg1) + 2; //make it longer for the initial slash and the null terminator
-    sd_path_buf = (char*)malloc(len); 
-    if(sd_path_buf != NULL){
-      cstring(arg1, &sd_path_buf[1], len-1);
-      sd_path_buf[0] = '/';  //really weird way to add a slash at the front...
-      root = SD.open(sd_path_buf);
+void bracketupdate (int y) {
+  if (BracketStale) return;
+  int i = BracketSize + y;
+  textline_t *line = textline(y);
+  BracketSum[i] = line->delta;
+  BracketMin[i] = line->mindepth;
+  for (i = i/2; i > 0; i = i/2) {
+    BracketSum[i] = BracketSum[2*i] + BracketSum[2*i + 1];
+    BracketMin[i] = min(BracketMin[2*i], BracketSum[2*i] + BracketMin[2*i + 1]);
+  }
+}
+
+void bracketrebuild () {
+  int n = textcount(), size = 1;
+  while (size < n) size = size * 2;
+  if (size != BracketSize) {
+    free(BracketSum); free(BracketMin);
+    BracketSum = (int *)malloc(2 * size * sizeof(int));
+    BracketMin = (int *)malloc(2 * size * sizeof(int));
+    BracketSize = size;
+    if (BracketSum == NULL || BracketMin == NULL) {
+      free(BracketSum); free(BracketMin);
+      BracketSum = BracketMin = NULL; BracketSize = 0;
+      error2("not enough memory for bracket index");
     }
   }
-  else{
-    root = SD.open("/");
+  for (int i = 0; i < size; i++) {
+    BracketSum[size + i] = (i < n) ? textline(i)->delta : 0;
+    BracketMin[size + i] = (i < n) ? textline(i)->mindepth : 0;
   }
+  for (int i = size - 1; i > 0; i--) {
+    BracketSum[i] = BracketSum[2*i] + BracketSum[2*i + 1];
+    BracketMin[i] = min(BracketMin[2*i], BracketSum[2*i] + BracketMin[2*i + 1]);
+  }
+  BracketStale = false;
+}
 
-  while (true) {
-    File entry =  root.openNextFile();
-    if (!entry) break; // no more files
-    object *filename = lispstring((char*)entry.name());
-    if (entry.isDirectory()) {
-      cdr(ptr) = cons(filename, NULL);
-    }else{
-      cdr(ptr) = cons(cons(filename, number(entry.size())), NULL);
+// Re-lex line y and at least n-1 lines after it, then carry on while the end state keeps changing
+void textrelex (int y, int n) {
+  int count = textcount();
+  uint8_t state = textstartstate(y);
+  for (; y < count; y++, n--) {
+    textline_t *line = textline(y);
+    uint8_t oldstate = line->endstate;
+    int depth = 0, mindepth = 0;
+    for (int i = 0; i < line->len; i++) {
+      int tok = lexchar(&state, line->text, line->len, i);
+      if (tok == TOK_OPEN) depth++;
+      else if (tok == TOK_CLOSE) mindepth = min(mindepth, --depth);
     }
-    ptr = cdr(ptr);
-    entry.close();
+    state = state & (LEX_STRING | LEX_BLOCK);
+    line->delta = depth;
+    line->mindepth = mindepth;
+    line->endstate = state;
+    bracketupdate(y);
+    if (n <= 1 && state == oldstate) return;
   }
-  
-  if(sd_path_buf != NULL) free(sd_path_buf);
-  root.close();
-  return cdr(result);
 }
 
-#endif
+// Bracket depth at the start of line y
+int bracketdepth (int y) {
+  int depth = 0;
+  for (int lo = BracketSize, hi = BracketSize + y; lo < hi; lo = lo/2, hi = hi/2) {
+    if (lo & 1) depth = depth + BracketSum[lo++];
+    if (hi & 1) depth = depth + BracketSum[--hi];
+  }
+  return depth;
+}
 
+// First line from lo whose depth drops to target; depth is the depth at the start of the node
+int bracketforward (int node, int nl, int nr, int lo, int *depth, int target) {
+  if (nr <= lo) return -1;
+  if (nl >= lo) {
+    if (*depth + BracketMin[node] > target) { *depth = *depth + BracketSum[node]; return -1; }
+    if (node >= BracketSize) return nl;
+  }
+  int mid = (nl + nr)/2;
+  int found = bracketforward(2*node, nl, mid, lo, depth, target);
+  if (found >= 0) return found;
+  return bracketforward(2*node + 1, mid, nr, lo, depth, target);
+}
 
-// Symbol names
-const char string_gettouchpoints[] PROGMEM = "get-touch-points";
-const char stringKeyboardGetKey[] PROGMEM = "keyboard-get-key";
-const char stringKeyboardFlush[] PROGMEM = "keyboard-flush";
-const char stringSearchStr[] PROGMEM = "search-str";
+// Last line before hi whose depth drops to target; depth is the depth at the end of the node
+int bracketbackward (int node, int nl, int nr, int hi, int *depth, int target) {
+  if (nl >= hi) return -1;
+  if (nr <= hi) {
+    if (*depth - BracketSum[node] + BracketMin[node] > target) { *depth = *depth - BracketSum[node]; return -1; }
+    if (node >= BracketSize) return nl;
+  }
+  int mid = (nl + nr)/2;
+  int found = bracketbackward(2*node + 1, mid, nr, hi, depth, target);
+  if (found >= 0) return found;
+  return bracketbackward(2*node, nl, mid, hi, depth, target);
+}
 
-#if defined sdcardsupport
-const char stringSDFileExists[] PROGMEM = "sd-file-exists";
-const char stringSDFileRemove[] PROGMEM = "sd-file-remove";
+// Find the bracket matching the one at (x,y) among the lines loaded so far
+bool bracketmatch (int x, int y, int *px, int *py) {
+  if (y < 0 || y >= textcount()) return false;
+  textline_t *line = textline(y);
+  if (x < 0 || x >= line->len) return false;
+  if (BracketStale) bracketrebuild();
+  uint8_t state = textstartstate(y);
+  int depth = bracketdepth(y), tok = TOK_CODE;
+  for (int i = 0; i <= x; i++) {
+    tok = lexchar(&state, line->text, line->len, i);
+    if (i < x && tok == TOK_OPEN) depth++;
+    else if (i < x && tok == TOK_CLOSE) depth--;
+  }
+  if (tok == TOK_OPEN) {
+    // The partner is the first ) after x that brings the depth back down
+    int target = depth, j = y, start = x + 1;
+    depth++;
+    for (;;) {
+      line = textline(j);
+      for (int i = start; i < line->len; i++) {
+        int t = lexchar(&state, line->text, line->len, i);
+        if (t == TOK_OPEN) depth++;
+        else if (t == TOK_CLOSE && --depth == target) { *px = i; *py = j; return true; }
+      }
+      depth = bracketdepth(j + 1);
+      j = bracketforward(1, 0, BracketSize, j + 1, &depth, target);
+      if (j < 0 || j >= textcount()) return false;
+      depth = bracketdepth(j);
+      state = textstartstate(j);
+      start = 0;
+    }
+  } else if (tok == TOK_CLOSE) {
+    // The partner is the last ( before x that starts at the same depth as the ) ends
+    int target = depth - 1, j = y, end = x;
+    for (;;) {
+      line = textline(j);
+      state = textstartstate(j);
+      int d = bracketdepth(j), found = -1;
+      for (int i = 0; i < end; i++) {
+        int t = lexchar(&state, line->text, line->len, i);
+        if (t == TOK_OPEN) { if (d == target) found = i; d++; }
+        else if (t == TOK_CLOSE) d--;
+      }
+      if (found >= 0) { *px = found; *py = j; return true; }
+      d = bracketdepth(j);
+      j = bracketbackward(1, 0, BracketSize, j, &d, target);
+      if (j < 0) return false;
+      end = textline(j)->len;
+    }
+  }
+  return false;
+}
 
-const char stringDir2[] PROGMEM = "dir2";
-#endif
+// Find the bracket matching the one at (x,y), loading more of the file if needed; returns false if there is none
+bool bracketpartner (int x, int y, int *px, int *py) {
+  textload(y);
+  while (!bracketmatch(x, y, px, py)) {
+    if (!TextLoading) return false;
+    textload(textcount() + TEXT_LOADAHEAD);
+  }
+  return true;
+}
 
+// Insert an empty line so that it becomes line y
+textline_t *textinsertline (int y) {
+  if (TextGapStart == TextGapEnd) textgrowtable();
+  textmovegap(y);
+  textline_t *line = &TextLines[TextGapStart++];
+  line->text = NULL; line->len = 0; line->cap = 0;
+  line->delta = 0; line->mindepth = 0; line->endstate = 0;
+  BracketStale = true;
+  return line;
+}
 
-// Documentation strings
-const char doc_gettouchpoints[] PROGMEM = "(get-touch-points)\n"
-"Returns all the points being touched on the screen in a list of x,y pairs or an empty list";
+void textremoveline (int y) {
+  textmovegap(y);
+  free(TextLines[TextGapEnd].text);
+  TextGapEnd++;
+  BracketStale = true;
+}
 
-const char docKeyboardGetKey[] PROGMEM = "(keyboard-get-key [pressed])\n"
-"Get key last recognized - default: when released, if [pressed] is t: when pressed).";
-const char docKeyboardFlush[] PROGMEM = "(keyboard-flush)\n"
-"Discard missing key up/down events.";
-const char docSearchStr[] PROGMEM = "(search pattern target [startpos])\n"
-"Returns the index of the first occurrence of pattern in target, or nil if it's not found\n"
-"starting from startpos";
+void textreserve (textline_t *line, int len) {
+  if (len <= line->cap) return;
+  if (len > 0xFFFF) error2("line too long");
+  int cap = (line->cap == 0) ? 16 : line->cap;
+  while (cap < len) cap = cap * 2;
+  if (cap > 0xFFFF) cap = 0xFFFF;
+  char *text = (char *)realloc(line->text, cap);
+  if (text == NULL) error2("not enough memory for text buffer");
+  line->text = text;
+  line->cap = cap;
+}
 
-#if defined sdcardsupport
-const char docSDFileExists[] PROGMEM = "(sd-file-exists filename)\n"
-"Returns t if filename exists on SD card, otherwise nil.";
-const char docSDFileRemove[] PROGMEM = "(sd-file-remove filename)\n"
+void textclear () {
+  textstopload();
+  TextIncomplete = false;
+  for (int y = textcount() - 1; y >= 0; y--) free(textline(y)->text);
+  free(TextLines);
+  TextLines = NULL;
+  TextCap = TextGapStart = TextGapEnd = 0;
+  BracketStale = true;
+  journalreset();
+}
+
+void textinsert (int x, int y, const char *s, int n) {
+  if (n <= 0) return;
+  textline_t *line = textline(y);
+  if (x > line->len) x = line->len;
+  textreserve(line, line->len + n);
+  memmove(&line->text[x + n], &line->text[x], line->len - x);
+  memcpy(&line->text[x], s, n);
+  line->len = line->len + n;
+  textrelex(y, 1);
+}
+
+void textdelete (int x, int y, int n) {
+  textline_t *line = textline(y);
+  if (x >= line->len) return;
+  if (n > line->len - x) n = line->len - x;
+  memmove(&line->text[x], &line->text[x + n], line->len - x - n);
+  line->len = line->len - n;
+  textrelex(y, 1);
+}
+
+// Break line y at x; the tail becomes line y+1
+void textsplit (int x, int y) {
+  textline_t *line = textline(y);
+  if (x > line->len) x = line->len;
+  textline_t *next = textinsertline(y + 1);
+  line = textline(y); // the table may have moved
+  next->endstate = line->endstate; // what the line after expects
+  int n = line->len - x;
+  if (n > 0) {
+    textreserve(next, n);
+    memcpy(next->text, &line->text[x], n);
+    next->len = n;
+    line->len = x;
+  }
+  textrelex(y, 2);
+}
+
+// Append line y+1 to line y, and return the old length of line y
+int textjoin (int y) {
+  textline_t *line = textline(y);
+  textline_t *next = textline(y + 1);
+  int x = line->len;
+  if (next->len > 0) {
+    textreserve(line, line->len + next->len);
+    memcpy(&line->text[x], next->text, next->len);
+    line->len = line->len + next->len;
+  }
+  line->endstate = next->endstate; // what the line after expects
+  textremoveline(y + 1);
+  textrelex(y, 1);
+  return x;
+}
+
+// File loader
+
+/*
+  A file is read into the buffer a block at a time and split into lines in place.
+  Only the lines asked for are read; the file stays open and the rest follows as
+  the editor moves further down, so the first screen shows without waiting for
+  the whole file.
+*/
+
+#if defined sdcardsupport
+File TextFile;
+#endif
+
+void textstopload () {
+  #if defined sdcardsupport
+  if (TextLoading) TextFile.close();
+  #endif
+  TextLoading = false;
+  TextOpen = false;
+}
+
+// Add n chars to the line being read, starting it if need be
+void textappend (const char *s, int n) {
+  if (!TextOpen) {
+    textinsertline(textcount());
+    TextOpen = true;
+  }
+  if (n == 0) return;
+  textline_t *line = textline(textcount() - 1);
+  textreserve(line, line->len + n);
+  memcpy(&line->text[line->len], s, n);
+  line->len = line->len + n;
+}
+
+void textendline () {
+  int y = textcount() - 1;
+  textline_t *line = textline(y);
+  if (line->len > 0 && line->text[line->len - 1] == '\r') line->len--;
+  textrelex(y, 1);
+  TextOpen = false;
+}
+
+// Make sure line upto has been read, if the file has that many lines
+void textload (int upto) {
+  #if defined sdcardsupport
+  static char block[TEXT_BLOCK];
+  if (upto < INT_MAX - TEXT_LOADAHEAD) upto = upto + TEXT_LOADAHEAD;
+  while (TextLoading && textcount() - TextOpen <= upto) {
+    int n = TextFile.read((uint8_t *)block, TEXT_BLOCK);
+    if (n > 0) Perf.sdread += n;
+    if (n <= 0) {
+      // A read that stops short of the end is an error, not the end of the file
+      bool failed = (TextFile.position() < TextFile.size());
+      if (TextOpen) textendline();
+      textstopload();
+      if (failed) {
+        TextIncomplete = true;
+        error2("couldn't read the rest of the file");
+      }
+      return;
+    }
+    int start = 0;
+    for (int i = 0; i < n; i++) {
+      if (block[i] == '\n') {
+        textappend(&block[start], i - start);
+        textendline();
+        start = i + 1;
+      }
+    }
+    if (start < n) textappend(&block[start], n - start);
+  }
+  #else
+  (void) upto;
+  #endif
+}
+
+int checkline (object *arg) {
+  int y = checkinteger(arg);
+  textload(y);
+  if (y < 0 || y >= textcount()) error2(indexrange);
+  return y;
+}
+
+object *textstring (textline_t *line, int start, int end) {
+  object *obj = newstring();
+  object *tail = obj;
+  for (int i = start; i < end; i++) buildstring((i < line->len) ? line->text[i] : ' ', &tail);
+  return obj;
+}
+
+// Edit journal
+
+/*
+  Undo history for the editor, kept as a ring of small deltas: what was done,
+  where, and the characters inserted or deleted. Each record ends with its own
+  length so the ring can be walked back from the newest one. When the ring is
+  full the oldest records are dropped, so the history costs JournalSize bytes
+  whatever the size of the file. Typing or deleting along a line within
+  JOURNAL_COALESCE_MS extends the last record instead of adding another.
+
+  Record: type, x, y, n (16 bits each but type), n chars, total length (16 bits).
+*/
+
+#define JOURNAL_SIZE        4096
+#define JOURNAL_HEADER      7
+#define JOURNAL_COALESCE_MS 1000
+#define JOURNAL_COALESCE_MAX 64   // chars a coalesced record may grow to
+
+enum { J_INSERT = 1, J_DELETE, J_SPLIT, J_JOIN };
+
+uint8_t *Journal = NULL;
+uint32_t JournalSize = JOURNAL_SIZE;
+uint32_t JournalTail = 0;    // start of the oldest record
+uint32_t JournalCursor = 0;  // end of the newest record not undone
+uint32_t JournalHead = 0;    // end of the newest record that can be redone
+uint32_t JournalTime = 0;    // millis() of the last edit recorded
+bool JournalOpen = false;    // the last record may still be extended
+
+void journalreset () {
+  JournalTail = JournalCursor = JournalHead = 0;
+  JournalOpen = false;
+}
+
+void journalput (uint32_t at, const char *data, int n) {
+  for (int i = 0; i < n; i++) Journal[(at + i) % JournalSize] = data[i];
+}
+
+void journalget (uint32_t at, char *data, int n) {
+  for (int i = 0; i < n; i++) data[i] = Journal[(at + i) % JournalSize];
+}
+
+int journalword (uint32_t at) {
+  return Journal[at % JournalSize] | Journal[(at + 1) % JournalSize]<<8;
+}
+
+void journalputword (uint32_t at, int w) {
+  Journal[at % JournalSize] = w & 0xFF;
+  Journal[(at + 1) % JournalSize] = w>>8 & 0xFF;
+}
+
+void journalwrite (int type, int x, int y, const char *text, int n) {
+  uint32_t size = JOURNAL_HEADER + n + 2;
+  JournalHead = JournalCursor; // a new edit ends the redo history
+  if (size > JournalSize) { journalreset(); return; }
+  while (JournalSize - (JournalHead - JournalTail) < size) {
+    JournalTail = JournalTail + JOURNAL_HEADER + journalword(JournalTail + 5) + 2;
+  }
+  Journal[JournalHead % JournalSize] = type;
+  journalputword(JournalHead + 1, x);
+  journalputword(JournalHead + 3, y);
+  journalputword(JournalHead + 5, n);
+  journalput(JournalHead + JOURNAL_HEADER, text, n);
+  journalputword(JournalHead + JOURNAL_HEADER + n, size);
+  JournalHead = JournalHead + size;
+  JournalCursor = JournalHead;
+}
+
+// Record an edit made through the buffer functions
+void journaladd (int type, int x, int y, const char *text, int n) {
+  if (Journal == NULL) {
+    Journal = (uint8_t *)malloc(JournalSize);
+    if (Journal == NULL) return;
+  }
+  uint32_t now = millis();
+  bool recent = JournalOpen && JournalCursor == JournalHead && JournalCursor != JournalTail &&
+    now - JournalTime < JOURNAL_COALESCE_MS;
+  JournalTime = now;
+  JournalOpen = (type == J_INSERT || type == J_DELETE);
+  if (recent && JournalOpen) {
+    uint32_t last = JournalCursor - journalword(JournalCursor - 2);
+    int type0 = Journal[last % JournalSize], x0 = journalword(last + 1), y0 = journalword(last + 3);
+    int n0 = journalword(last + 5);
+    if (type == type0 && y == y0 && n0 + n <= JOURNAL_COALESCE_MAX) {
+      char merged[JOURNAL_COALESCE_MAX];
+      if (type == J_INSERT && x == x0 + n0) {
+        // Typing on from the end of the last insert
+        journalget(last + JOURNAL_HEADER, merged, n0);
+        memcpy(&merged[n0], text, n);
+        JournalCursor = last;
+        journalwrite(type, x0, y, merged, n0 + n);
+        return;
+      } else if (type == J_DELETE && (x + n == x0 || x == x0)) {
+        // Backspacing into, or deleting forward from, the last delete
+        int at = (x == x0) ? 0 : n;
+        journalget(last + JOURNAL_HEADER, &merged[at], n0);
+        memcpy(&merged[(x == x0) ? n0 : 0], text, n);
+        JournalCursor = last;
+        journalwrite(type, min(x, x0), y, merged, n0 + n);
+        return;
+      }
+    }
+  }
+  journalwrite(type, x, y, text, n);
+}
+
+// Apply the record at start, forwards for a redo or backwards for an undo, and set the cursor position
+void journalapply (uint32_t start, bool redo, int *px, int *py) {
+  int type = Journal[start % JournalSize], x = journalword(start + 1), y = journalword(start + 3);
+  int n = journalword(start + 5);
+  textload(y + 1);
+  if (y >= textcount()) { journalreset(); error2("undo history doesn't match the buffer"); }
+  char *text = NULL;
+  if (n > 0) {
+    text = (char *)malloc(n);
+    if (text == NULL) error2("not enough memory for text buffer");
+    journalget(start + JOURNAL_HEADER, text, n);
+  }
+  *px = x; *py = y;
+  if (type == J_SPLIT || type == J_JOIN) redo = (redo == (type == J_SPLIT)); // undoing a join is a split
+  if (type == J_INSERT || type == J_DELETE) {
+    if (redo == (type == J_INSERT)) { textinsert(x, y, text, n); *px = x + n; }
+    else textdelete(x, y, n);
+  } else if (redo) { textsplit(x, y); *px = 0; *py = y + 1; }
+  else if (y + 1 < textcount()) textjoin(y);
+  free(text);
+  JournalOpen = false;
+}
+
+/*
+  (buffer-undo)
+  Undoes the last edit made through the buffer functions, and returns the cursor
+  position (x . y) to go back to, or nil if there is nothing to undo.
+*/
+object *fn_BufferUndo (object *args, object *env) {
+  (void) args, (void) env;
+  int x, y;
+  if (Journal == NULL || JournalCursor == JournalTail) return nil;
+  uint32_t start = JournalCursor - journalword(JournalCursor - 2);
+  JournalCursor = start;
+  journalapply(start, false, &x, &y);
+  return cons(number(x), number(y));
+}
+
+/*
+  (buffer-redo)
+  Redoes the last edit undone, and returns the cursor position (x . y), or nil if there is nothing to redo.
+*/
+object *fn_BufferRedo (object *args, object *env) {
+  (void) args, (void) env;
+  int x, y;
+  if (Journal == NULL || JournalCursor == JournalHead) return nil;
+  uint32_t start = JournalCursor;
+  JournalCursor = start + JOURNAL_HEADER + journalword(start + 5) + 2;
+  journalapply(start, true, &x, &y);
+  return cons(number(x), number(y));
+}
+
+/*
+  (buffer-journal-size [bytes])
+  Returns the size of the undo history, after setting it to bytes and clearing it if given.
+*/
+object *fn_BufferJournalSize (object *args, object *env) {
+  (void) env;
+  if (args != NULL) {
+    int size = checkinteger(first(args));
+    if (size < 64) error2(indexrange);
+    free(Journal);
+    Journal = NULL;
+    JournalSize = size;
+    journalreset();
+  }
+  return number(JournalSize);
+}
+
+/*
+  (buffer-clear)
+  Removes all lines from the editor buffer.
+*/
+object *fn_BufferClear (object *args, object *env) {
+  (void) args, (void) env;
+  textclear();
+  return nil;
+}
+
+/*
+  (buffer-lines [upto])
+  Returns the number of lines in the editor buffer. While a file is still loading,
+  upto limits how far it is read: the count is then only sure to be more than upto.
+*/
+object *fn_BufferLines (object *args, object *env) {
+  (void) env;
+  textload((args != NULL) ? checkinteger(first(args)) : INT_MAX);
+  return number(textcount() - TextOpen);
+}
+
+/*
+  (buffer-move x y dx dy)
+  Returns the position (x . y) reached from x in line y by moving dx characters right, or
+  left if dx is negative, going on to the next or previous line at a line end, and then dy
+  lines down or up, keeping x within the line.
+*/
+object *fn_BufferMove (object *args, object *env) {
+  (void) env;
+  int x = checkinteger(first(args)), y = checkline(second(args));
+  int dx = checkinteger(third(args)), dy = checkinteger(first(cdr(cddr(args))));
+  x = max(x, 0);
+  while (dx > 0) {
+    int len = textline(y)->len;
+    if (x < len) {
+      int step = min(dx, len - x);
+      x = x + step; dx = dx - step;
+    } else {
+      textload(y + 2);
+      if (y + 1 >= textcount() - TextOpen) break;
+      y++; x = 0; dx--;
+    }
+  }
+  while (dx < 0) {
+    if (x > 0) {
+      int step = min(-dx, x);
+      x = x - step; dx = dx + step;
+    } else if (y > 0) {
+      y--; x = textline(y)->len; dx++;
+    } else break;
+  }
+  if (dy != 0) {
+    if (dy > 0) textload(y + dy + 1);
+    y = max(0, min(y + dy, textcount() - TextOpen - 1));
+    x = min(x, (int)textline(y)->len);
+  }
+  return cons(number(x), number(y));
+}
+
+/*
+  (buffer-line y [start end])
+  Returns line y as a string, or nil if there is no such line.
+*/
+object *fn_BufferLine (object *args, object *env) {
+  (void) env;
+  int y = checkinteger(first(args));
+  textload(y);
+  if (y < 0 || y >= textcount()) return nil;
+  textline_t *line = textline(y);
+  int start = 0, end = line->len;
+  args = cdr(args);
+  if (args != NULL) {
+    start = checkinteger(first(args));
+    args = cdr(args);
+    if (args != NULL) end = checkinteger(first(args));
+  }
+  if (start < 0 || end < start) error2(indexrange);
+  return textstring(line, start, end);
+}
+
+/*
+  (buffer-line-length y)
+  Returns the length of line y, or 0 if there is no such line.
+*/
+object *fn_BufferLineLength (object *args, object *env) {
+  (void) env;
+  int y = checkinteger(first(args));
+  textload(y);
+  if (y < 0 || y >= textcount()) return number(0);
+  return number(textline(y)->len);
+}
+
+/*
+  (buffer-char x y)
+  Returns the character at x in line y, or nil if x is past the end of the line.
+*/
+object *fn_BufferChar (object *args, object *env) {
+  (void) env;
+  int x = checkinteger(first(args));
+  int y = checkinteger(second(args));
+  textload(y);
+  if (y < 0 || y >= textcount()) return nil;
+  textline_t *line = textline(y);
+  if (x < 0 || x >= line->len) return nil;
+  return character(line->text[x]);
+}
+
+/*
+  (buffer-insert x y item)
+  Inserts a character or string into line y before x, and returns the new x.
+*/
+object *fn_BufferInsert (object *args, object *env) {
+  (void) env;
+  int x = checkinteger(first(args));
+  int y = checkline(second(args));
+  object *item = third(args);
+  if (x < 0) error2(indexrange);
+  x = min(x, (int)textline(y)->len);
+  if (characterp(item)) {
+    char c = checkchar(item);
+    journaladd(J_INSERT, x, y, &c, 1);
+    textinsert(x, y, &c, 1);
+    return number(x + 1);
+  }
+  int n = stringlength(checkstring(item));
+  char *buf = (char *)malloc(n + 1);
+  if (buf == NULL) error2("not enough memory for text buffer");
+  cstring(item, buf, n + 1);
+  if (n > 0) journaladd(J_INSERT, x, y, buf, n);
+  textinsert(x, y, buf, n);
+  free(buf);
+  return number(x + n);
+}
+
+/*
+  (buffer-delete x y [n])
+  Deletes n characters, default 1, from line y starting at x.
+*/
+object *fn_BufferDelete (object *args, object *env) {
+  (void) env;
+  int x = checkinteger(first(args));
+  int y = checkline(second(args));
+  int n = 1;
+  if (cddr(args) != NULL) n = checkinteger(third(args));
+  if (x < 0 || n < 0) error2(indexrange);
+  textline_t *line = textline(y);
+  if (x < line->len && n > 0) journaladd(J_DELETE, x, y, &line->text[x], min(n, line->len - x));
+  textdelete(x, y, n);
+  return nil;
+}
+
+/*
+  (buffer-split-line x y)
+  Breaks line y at x, moving the rest of the line to a new line after it.
+*/
+object *fn_BufferSplitLine (object *args, object *env) {
+  (void) env;
+  int x = checkinteger(first(args));
+  int y = checkline(second(args));
+  if (x < 0) error2(indexrange);
+  x = min(x, (int)textline(y)->len);
+  journaladd(J_SPLIT, x, y, NULL, 0);
+  textsplit(x, y);
+  return nil;
+}
+
+/*
+  (buffer-join-lines y)
+  Appends line y+1 to line y, and returns the length line y had before.
+*/
+object *fn_BufferJoinLines (object *args, object *env) {
+  (void) env;
+  int y = checkline(first(args));
+  textload(y + 1);
+  if (y + 1 >= textcount()) error2(indexrange);
+  int x = textjoin(y);
+  journaladd(J_JOIN, x, y, NULL, 0);
+  return number(x);
+}
+
+/*
+  (buffer-add-line [string])
+  Appends a line to the end of the editor buffer.
+*/
+object *fn_BufferAddLine (object *args, object *env) {
+  (void) env;
+  textload(INT_MAX);
+  int y = textcount();
+  textinsertline(y);
+  if (args != NULL) {
+    object *item = first(args);
+    int n = stringlength(checkstring(item));
+    textline_t *line = textline(y);
+    textreserve(line, n + 1);
+    cstring(item, line->text, n + 1);
+    line->len = n;
+  }
+  textrelex(y, 1);
+  return nil;
+}
+
+/*
+  (buffer-from-list list)
+  Replaces the editor buffer with a list of strings, one per line.
+*/
+object *fn_BufferFromList (object *args, object *env) {
+  (void) env;
+  textclear();
+  for (object *lines = first(args); lines != NULL; lines = cdr(lines)) {
+    fn_BufferAddLine(cons(car(lines), NULL), env);
+  }
+  if (textcount() == 0) textinsertline(0);
+  return nil;
+}
+
+/*
+  (bracket-partner x y)
+  Returns the position (x . y) of the bracket matching the one at x in line y, or nil.
+*/
+object *fn_BracketPartner (object *args, object *env) {
+  (void) env;
+  int x = checkinteger(first(args));
+  int y = checkinteger(second(args));
+  int px, py;
+  uint32_t start = micros();
+  bool found = bracketpartner(x, y, &px, &py);
+  Perf.section[PERF_BRACKET] += micros() - start;
+  if (!found) return nil;
+  return cons(number(px), number(py));
+}
+
+/*
+  (buffer-to-list)
+  Returns the lines in the editor buffer as a list of strings.
+*/
+object *fn_BufferToList (object *args, object *env) {
+  (void) args, (void) env;
+  object *result = cons(NULL, NULL);
+  object *ptr = result;
+  textload(INT_MAX);
+  for (int y = 0; y < textcount(); y++) {
+    textline_t *line = textline(y);
+    cdr(ptr) = cons(textstring(line, 0, line->len), NULL);
+    ptr = cdr(ptr);
+  }
+  return cdr(result);
+}
+
+// Palette
+
+/*
+  16-bit colours of the current editor skin, converted once when the skin is
+  loaded and then read by index, from Lisp or directly by the renderer.
+*/
+
+#define PALETTE_SIZE 16
+
+enum { PAL_CODE, PAL_LINE, PAL_BORDER, PAL_BG, PAL_CURSOR, PAL_EMPH, PAL_ALERT, PAL_INPUT,
+  PAL_STRING, PAL_COMMENT, PAL_NUMBER, PAL_KEYWORD };
+
+uint16_t Palette[PALETTE_SIZE] = { 0xDEFB, 0x5ACB, 0x3940, 0x0000, 0xA1E0, 0x0400, 0xE800, 0xDEFB,
+  0xCD0A, 0x6C0D, 0x7DBC, 0xCBD9 };
+
+void screeninvalidate (int top, int bottom);
+
+/*
+  (palette-load colours)
+  Replaces the palette with a list of 16-bit colours, and marks the editor screen for a redraw.
+*/
+object *fn_PaletteLoad (object *args, object *env) {
+  (void) env;
+  int i = 0;
+  for (object *colors = first(args); colors != NULL && i < PALETTE_SIZE; colors = cdr(colors)) {
+    Palette[i++] = checkinteger(car(colors));
+  }
+  #if defined(gfxsupport)
+  screeninvalidate(0, 0x7FFF);
+  #endif
+  return nil;
+}
+
+/*
+  (palette index)
+  Returns the 16-bit colour at index in the palette.
+*/
+object *fn_Palette (object *args, object *env) {
+  (void) env;
+  int i = checkinteger(first(args));
+  if (i < 0 || i >= PALETTE_SIZE) error2(indexrange);
+  return number(Palette[i]);
+}
+
+#if defined(gfxsupport)
+// Screen renderer
+
+/*
+  Keeps a copy of the characters, colours and line numbers currently shown on
+  each text row of the editor, and on refresh only sends the spans of characters
+  that differ from the buffer. Rows overwritten by messages or dialogs are marked
+  invalid, and are cleared and redrawn in full on the next refresh.
+
+  Each visible line is coloured by lexing it from the state saved at the end of
+  the line before, so highlighting costs a screenful of lexing per refresh
+  whatever the length of the file.
+*/
+
+#define SCREEN_MAXCOLS 54
+#define SCREEN_MAXROWS 24
+#define SCREEN_CWIDTH  6
+#define SCREEN_LEADING 10
+#define SCREEN_GUTTER  5   // characters in the line number gutter
+
+int ScreenX = 34, ScreenY = 18, ScreenCols = 47, ScreenRows = 22;
+char ScreenText[SCREEN_MAXROWS][SCREEN_MAXCOLS];
+uint8_t ScreenColour[SCREEN_MAXROWS][SCREEN_MAXCOLS];  // palette index of each character
+bool ScreenHighlight = true;
+int ScreenLine[SCREEN_MAXROWS];  // line number in the gutter, or 0 for none
+bool ScreenValid[SCREEN_MAXROWS];
+
+void screeninvalidate (int top, int bottom) {
+  for (int r = 0; r < ScreenRows; r++) {
+    int ry = ScreenY + r*SCREEN_LEADING;
+    if (ry + SCREEN_LEADING > top && ry <= bottom) ScreenValid[r] = false;
+  }
+}
+
+// Hardware scroll
+
+/*
+  The ST7789 scrolls a band of its frame memory, but only along its own 320-pixel
+  axis, which on the T-Deck's landscape screen runs across: it can move the text
+  sideways, not up and down. A horizontal move of the view is then one command and
+  the newly exposed columns, instead of a screenful of changed characters; vertical
+  moves still go through the renderer, which only sends the characters that change.
+
+  The band runs from the left edge of the text area to its last whole column, and
+  the gutter to the left stays put. While it is scrolled, text runs are sent to where
+  they belong in the scrolled frame memory, and the title line above the text, which
+  moves with the band, is redrawn from a copy kept of it. Anything else drawn over
+  the band must first put the scroll back with screen-overlay, after which the text
+  rows are redrawn in full.
+
+  The scroll registers count frame memory rows. Adafruit's rotations 0 and 1 set
+  MADCTL MY, which lays those rows out in reverse of the x (or y) the host draws at,
+  so the fixed areas swap ends and the start row counts the other way.
+*/
+
+#define ST7789_VSCRDEF 0x33
+#define ST7789_VSCSAD  0x37
+
+bool ScrollOn = false;
+int ScrollTop = 0, ScrollArea = 0;  // first pixel column of the band, and its width
+int ScrollPix = 0;                  // pixels the band is scrolled left by
+int ScreenOX = 0;                   // column of the buffer the text rows were drawn from
+char TitleText[SCREEN_MAXCOLS];     // the title line as drawn, 0 where nothing has been
+uint16_t TitleFg[SCREEN_MAXCOLS], TitleBg[SCREEN_MAXCOLS];
+
+// Text runs
+
+/*
+  A run of characters is drawn from the classic 5x7 font into a line buffer a
+  character cell high, each character in its own colours, and sent to the display
+  as one window of pixels, or two if it wraps round the scrolled band. Drawing the
+  same text with print sends every pixel of every glyph with its own address window.
+*/
+
+#include <glcdfont.c>
+
+#define RUN_MAXCHARS 54
+
+uint16_t RunBuffer[RUN_MAXCHARS*SCREEN_CWIDTH*SCREEN_LEADING];
+
+void textrun (int x, int y, const char *text, const uint16_t *fg, const uint16_t *bg, int n) {
+  n = min(n, min(RUN_MAXCHARS, (tft.width() - x)/SCREEN_CWIDTH));
+  if (n <= 0 || y < 0 || y + SCREEN_LEADING > tft.height()) return;
+  int w = n*SCREEN_CWIDTH;
+  for (int i = 0; i < n; i++) {
+    const unsigned char *glyph = &font[(uint8_t)text[i]*5];
+    for (int col = 0; col < SCREEN_CWIDTH; col++) {
+      uint8_t bits = (col < 5) ? pgm_read_byte(&glyph[col]) : 0;
+      uint16_t *pixel = &RunBuffer[i*SCREEN_CWIDTH + col];
+      for (int row = 0; row < SCREEN_LEADING; row++) {
+        *pixel = (bits & 1) ? fg[i] : bg[i];
+        bits = bits>>1;
+        pixel = pixel + w;
+      }
+    }
+  }
+  if (y == 0 && x % SCREEN_CWIDTH == 0) {
+    int t = x/SCREEN_CWIDTH;
+    int m = min(n, SCREEN_MAXCOLS - t);
+    memcpy(&TitleText[t], text, m);
+    memcpy(&TitleFg[t], fg, m*sizeof(uint16_t));
+    memcpy(&TitleBg[t], bg, m*sizeof(uint16_t));
+  }
+  tft.startWrite();
+  for (int col = 0; col < w; ) {
+    int px = x + col, seg = w - col;
+    if (ScrollPix != 0 && px < ScrollTop) seg = min(seg, ScrollTop - px);
+    else if (ScrollPix != 0 && px < ScrollTop + ScrollArea) {
+      int offset = (px - ScrollTop + ScrollPix) % ScrollArea;
+      px = ScrollTop + offset;
+      seg = min(seg, ScrollArea - offset);
+    }
+    tft.setAddrWindow(px, y, seg, SCREEN_LEADING);
+    if (seg == w) tft.writePixels(RunBuffer, w*SCREEN_LEADING);
+    else for (int row = 0; row < SCREEN_LEADING; row++) tft.writePixels(&RunBuffer[row*w + col], seg);
+    perfdisplay(seg*SCREEN_LEADING, 11 + 2*seg*SCREEN_LEADING);
+    col = col + seg;
+  }
+  tft.endWrite();
+}
+
+// Draw n characters of the editor text, each in its palette colour on the background
+void screenspan (int x, int y, const char *text, const uint8_t *colour, int n) {
+  uint16_t fg[SCREEN_MAXCOLS], bg[SCREEN_MAXCOLS];
+  for (int i = 0; i < n; i++) { fg[i] = Palette[colour[i]]; bg[i] = Palette[PAL_BG]; }
+  textrun(x, y, text, fg, bg, n);
+}
+
+// Display list
+
+/*
+  While recording, text drawn with draw-text-run or screen-restore goes into a list
+  of character cells instead of to the display, and a character drawn where one is
+  already recorded replaces it. Flushing sorts the cells into rows and sends each
+  row of adjacent cells as one text run, so a key handler that draws over the
+  cursor and the line number several times sends each cell once.
+
+  The list is flushed before the renderer draws and before keyboard-get-key, so
+  nothing recorded can land on top of something drawn after it; anything else
+  that draws over the text area should flush first.
+*/
+
+#define DISPLAY_CELLS 64
+
+typedef struct {
+  int16_t x, y;
+  char c;
+  uint16_t fg, bg;
+} displaycell_t;
+
+displaycell_t DisplayList[DISPLAY_CELLS];
+int DisplayCount = 0;
+bool DisplayRecording = false;
+
+int displaycompare (const void *a, const void *b) {
+  const displaycell_t *p = (const displaycell_t *)a, *q = (const displaycell_t *)b;
+  return (p->y != q->y) ? p->y - q->y : p->x - q->x;
+}
+
+// Send the recorded cells and empty the list; returns the number of runs sent
+int displayflush () {
+  int runs = 0, i = 0;
+  qsort(DisplayList, DisplayCount, sizeof(displaycell_t), displaycompare);
+  while (i < DisplayCount) {
+    char text[RUN_MAXCHARS];
+    uint16_t fg[RUN_MAXCHARS], bg[RUN_MAXCHARS];
+    displaycell_t *head = &DisplayList[i];
+    int n = 0;
+    do {
+      text[n] = DisplayList[i].c; fg[n] = DisplayList[i].fg; bg[n] = DisplayList[i].bg;
+      n++; i++;
+    } while (i < DisplayCount && n < RUN_MAXCHARS && DisplayList[i].y == head->y && DisplayList[i].x == head->x + n*SCREEN_CWIDTH);
+    textrun(head->x, head->y, text, fg, bg, n);
+    runs++;
+  }
+  DisplayCount = 0;
+  return runs;
+}
+
+// Draw a run of text now, or record it if the display list is recording
+void displaytext (int x, int y, const char *text, const uint16_t *fg, const uint16_t *bg, int n) {
+  if (!DisplayRecording) { textrun(x, y, text, fg, bg, n); return; }
+  for (int i = 0; i < n; i++, x = x + SCREEN_CWIDTH) {
+    int j = 0;
+    while (j < DisplayCount && (DisplayList[j].x != x || DisplayList[j].y != y)) j++;
+    if (j == DISPLAY_CELLS) { displayflush(); j = 0; }
+    if (j == DisplayCount) DisplayCount++;
+    displaycell_t cell = { (int16_t)x, (int16_t)y, text[i], fg[i], bg[i] };
+    DisplayList[j] = cell;
+  }
+}
+
+/*
+  (display-list on)
+  Starts recording text drawn with draw-text-run, or if on is nil, flushes what has been
+  recorded and stops.
+*/
+object *fn_DisplayList (object *args, object *env) {
+  (void) env;
+  DisplayRecording = (first(args) != nil);
+  if (!DisplayRecording) displayflush();
+  return DisplayRecording ? tee : nil;
+}
+
+/*
+  (display-flush)
+  Sends the text recorded in the display list, and returns the number of runs sent.
+*/
+object *fn_DisplayFlush (object *args, object *env) {
+  (void) args, (void) env;
+  return number(displayflush());
+}
+
+/*
+  (draw-text-run x y fg bg text [fg bg text]*)
+  Draws each text, a string or character, in the colours before it, one after the
+  other from x,y, and sends the whole run to the display at once.
+*/
+object *fn_DrawTextRun (object *args, object *env) {
+  (void) env;
+  char text[RUN_MAXCHARS + 1];
+  uint16_t fg[RUN_MAXCHARS], bg[RUN_MAXCHARS];
+  int x = checkinteger(first(args)), y = checkinteger(second(args)), n = 0;
+  args = cddr(args);
+  while (args != NULL) {
+    if (cdr(args) == NULL || cddr(args) == NULL) error2("fg, bg and text must come in threes");
+    uint16_t f = checkinteger(first(args)), b = checkinteger(second(args));
+    object *item = third(args);
+    int len = characterp(item) ? 1 : stringlength(checkstring(item));
+    if (n + len > RUN_MAXCHARS) error2("text run longer than a line");
+    if (characterp(item)) text[n] = checkchar(item);
+    else cstring(item, &text[n], len + 1);
+    for (int i = n; i < n + len; i++) { fg[i] = f; bg[i] = b; }
+    n = n + len;
+    args = cdr(cddr(args));
+  }
+  displaytext(x, y, text, fg, bg, n);
+  return nil;
+}
+
+const char *HighlightWords[] = { "defun", "defvar", "defmacro", "lambda", "let", "let*", "if", "when",
+  "unless", "cond", "case", "and", "or", "not", "progn", "loop", "dolist", "dotimes", "return", "setf",
+  "setq", "incf", "decf", "push", "pop", "with-sd-card", NULL };
+
+bool highlightword (const char *text, int len) {
+  if (text[0] == ':') return true;
+  for (int w = 0; HighlightWords[w] != NULL; w++) {
+    if ((int)strlen(HighlightWords[w]) == len && strncmp(HighlightWords[w], text, len) == 0) return true;
+  }
+  return false;
+}
+
+bool highlightnumber (const char *text, int len) {
+  int i = (len > 1 && (text[0] == '-' || text[0] == '+')) ? 1 : 0;
+  if (text[i] == '#' && i + 1 < len) return strchr("xXbBoO", text[i + 1]) != NULL;
+  return isdigit(text[i]) || (text[i] == '.' && i + 1 < len && isdigit(text[i + 1]));
+}
+
+// Palette index of each character of line y in columns ox to ox+n-1
+void highlightline (int y, int ox, int n, uint8_t *colour) {
+  textline_t *line = textline(y);
+  uint8_t state = textstartstate(y);
+  bool head = false; // the next atom is the first in a list
+  int i = 0;
+  memset(colour, PAL_CODE, n);
+  while (i < line->len && i < ox + n) {
+    int tok = lexchar(&state, line->text, line->len, i), end = i + 1, pal = PAL_CODE;
+    if (tok == TOK_STRING || tok == TOK_CHAR) pal = PAL_STRING;
+    else if (tok == TOK_COMMENT) pal = PAL_COMMENT;
+    else if (tok == TOK_CODE && !strchr(" \t'`,", line->text[i])) {
+      // An atom runs on to the next delimiter
+      while (end < line->len && !strchr(" \t'`,()\";", line->text[end])) end++;
+      if (highlightnumber(&line->text[i], end - i)) pal = PAL_NUMBER;
+      else if (head && highlightword(&line->text[i], end - i)) pal = PAL_KEYWORD;
+      else if (line->text[i] == ':') pal = PAL_KEYWORD;
+      for (int j = i + 1; j < end; j++) lexchar(&state, line->text, line->len, j);
+    }
+    if (tok != TOK_CODE || !strchr(" \t", line->text[i])) head = (tok == TOK_OPEN);
+    for (int j = max(i, ox); j < min(end, ox + n); j++) colour[j - ox] = pal;
+    i = end;
+  }
+}
+
+// Scrolling
+
+bool scrollreversed () {
+  return tft.getRotation() < 2;
+}
+
+// The fixed area before the band, in frame memory rows
+int scrollfixed () {
+  return scrollreversed() ? tft.width() - ScrollTop - ScrollArea : ScrollTop;
+}
+
+void scrollstart () {
+  uint16_t start = scrollfixed() + (scrollreversed() ? (ScrollArea - ScrollPix) % ScrollArea : ScrollPix);
+  uint8_t data[2] = { (uint8_t)(start>>8), (uint8_t)start };
+  tft.sendCommand(ST7789_VSCSAD, data, 2);
+  perfdisplay(0, 3);
+}
+
+// Redraw the title line over the band, which moves with it
+void scrolltitle () {
+  int w = tft.width() - ScrollTop;
+  tft.fillRect(ScrollTop, 0, w, ScreenY, Palette[PAL_BG]);
+  perfdisplay(w*ScreenY, 11 + 2*w*ScreenY);
+  int i = 0;
+  while (i < SCREEN_MAXCOLS) {
+    if (TitleText[i] == 0 || (i + 1)*SCREEN_CWIDTH <= ScrollTop) { i++; continue; }
+    int start = i;
+    while (i < SCREEN_MAXCOLS && TitleText[i] != 0) i++;
+    textrun(start*SCREEN_CWIDTH, 0, &TitleText[start], &TitleFg[start], &TitleBg[start], i - start);
+  }
+}
+
+// Set the band to the text area's columns, unscrolled
+void scrolldefine () {
+  ScrollTop = ScreenX;
+  ScrollArea = min(ScreenCols, (tft.width() - ScreenX)/SCREEN_CWIDTH)*SCREEN_CWIDTH;
+  uint16_t top = scrollfixed(), bottom = tft.width() - top - ScrollArea;
+  uint8_t data[6] = { (uint8_t)(top>>8), (uint8_t)top, (uint8_t)(ScrollArea>>8), (uint8_t)ScrollArea,
+    (uint8_t)(bottom>>8), (uint8_t)bottom };
+  tft.sendCommand(ST7789_VSCRDEF, data, 6);
+  perfdisplay(0, 7);
+  ScrollPix = 0;
+  scrollstart();
+}
+
+// Put the band back where it started; the text rows are then redrawn in full
+void scrollreset () {
+  if (ScrollPix == 0) return;
+  ScrollPix = 0;
+  scrollstart();
+  screeninvalidate(0, 0x7FFF);
+  scrolltitle();
+}
+
+// Scroll the band left by dx columns, or right if dx is negative, and shift the copy of the text rows to match
+bool scrollcolumns (int dx) {
+  int cols = ScrollArea/SCREEN_CWIDTH, n = cols - abs(dx);
+  if (!ScrollOn || dx == 0 || n <= 0) return false;
+  ScrollPix = ((ScrollPix + dx*SCREEN_CWIDTH) % ScrollArea + ScrollArea) % ScrollArea;
+  scrollstart();
+  // The columns that wrap round into view are unknown, so they will be redrawn
+  for (int r = 0; r < ScreenRows; r++) {
+    if (dx > 0) {
+      memmove(ScreenText[r], &ScreenText[r][dx], n);
+      memmove(ScreenColour[r], &ScreenColour[r][dx], n);
+      memset(&ScreenText[r][n], 0, dx);
+    } else {
+      memmove(&ScreenText[r][-dx], ScreenText[r], n);
+      memmove(&ScreenColour[r][-dx], ScreenColour[r], n);
+      memset(ScreenText[r], 0, -dx);
+    }
+  }
+  scrolltitle();
+  return true;
+}
+
+void screenrefresh (int ox, int oy) {
+  displayflush();
+  if (ox != ScreenOX) scrollcolumns(ox - ScreenOX);
+  ScreenOX = ox;
+  textload(oy + ScreenRows - 1);
+  int count = textcount();
+  char want[SCREEN_MAXCOLS];
+  uint8_t colour[SCREEN_MAXCOLS];
+  for (int r = 0; r < ScreenRows; r++) {
+    int y = oy + r, ry = ScreenY + r*SCREEN_LEADING;
+    if (!ScreenValid[r]) {
+      tft.fillRect(0, ry, ScreenX - 2, SCREEN_LEADING, Palette[PAL_BG]);
+      tft.fillRect(ScreenX, ry, tft.width() - ScreenX, SCREEN_LEADING, Palette[PAL_BG]);
+      perfdisplay((tft.width() - 2)*SCREEN_LEADING, 2*11 + 2*(tft.width() - 2)*SCREEN_LEADING);
+      memset(ScreenText[r], ' ', ScreenCols);
+      memset(ScreenColour[r], PAL_CODE, ScreenCols);
+      ScreenLine[r] = 0;
+      ScreenValid[r] = true;
+    }
+    // Line number
+    int number = (y < count) ? y + 1 : 0;
+    if (ScreenLine[r] != number) {
+      char buf[SCREEN_GUTTER + 1];
+      uint8_t gutter[SCREEN_GUTTER];
+      if (number) snprintf(buf, SCREEN_GUTTER + 1, "%-*d", SCREEN_GUTTER, number);
+      else memset(buf, ' ', SCREEN_GUTTER);
+      memset(gutter, PAL_LINE, SCREEN_GUTTER);
+      screenspan(0, ry, buf, gutter, SCREEN_GUTTER);
+      ScreenLine[r] = number;
+    }
+    // Text, sent as runs of changed characters; short unchanged gaps are resent rather than split
+    memset(want, ' ', ScreenCols);
+    memset(colour, PAL_CODE, ScreenCols);
+    if (y < count) {
+      textline_t *line = textline(y);
+      if (line->len > ox) memcpy(want, &line->text[ox], min(line->len - ox, ScreenCols));
+      if (ScreenHighlight) {
+        uint32_t start = micros();
+        highlightline(y, ox, ScreenCols, colour);
+        Perf.section[PERF_HIGHLIGHT] += micros() - start;
+      }
+    }
+    int c = 0;
+    while (c < ScreenCols) {
+      if (want[c] == ScreenText[r][c] && (want[c] == ' ' || colour[c] == ScreenColour[r][c])) { c++; continue; }
+      int start = c, end = c + 1, same = 0;
+      for (c++; c < ScreenCols && same < 4; c++) {
+        if (want[c] == ScreenText[r][c] && (want[c] == ' ' || colour[c] == ScreenColour[r][c])) same++;
+        else { same = 0; end = c + 1; }
+      }
+      screenspan(ScreenX + start*SCREEN_CWIDTH, ry, &want[start], &colour[start], end - start);
+      memcpy(&ScreenText[r][start], &want[start], end - start);
+      memcpy(&ScreenColour[r][start], &colour[start], end - start);
+      c = end;
+    }
+  }
+}
+
+/*
+  (screen-setup x y cols rows)
+  Sets the position and size of the editor text area, and marks it all invalid.
+  The columns are cut to those that fit whole on the display. Also flushes and stops the
+  display list and puts the scroll back, in case an error left an editor's behind.
+*/
+object *fn_ScreenSetup (object *args, object *env) {
+  (void) env;
+  ScreenX = checkinteger(first(args));
+  ScreenY = checkinteger(second(args));
+  ScreenCols = min(max(checkinteger(third(args)), 1), SCREEN_MAXCOLS);
+  ScreenCols = max(min(ScreenCols, (tft.width() - ScreenX)/SCREEN_CWIDTH), 1);
+  ScreenRows = min(max(checkinteger(first(cdr(cddr(args)))), 1), SCREEN_MAXROWS);
+  for (int r = 0; r < SCREEN_MAXROWS; r++) ScreenValid[r] = false;
+  displayflush();
+  DisplayRecording = false;
+  scrollreset();
+  memset(TitleText, 0, SCREEN_MAXCOLS);
+  if (ScrollOn) scrolldefine();
+  return nil;
+}
+
+/*
+  (screen-invalidate [top bottom])
+  Marks the text rows between pixel rows top and bottom, default all, for a full redraw.
+*/
+object *fn_ScreenInvalidate (object *args, object *env) {
+  (void) env;
+  int top = 0, bottom = 0x7FFF;
+  if (args != NULL) {
+    top = checkinteger(first(args));
+    bottom = (cdr(args) != NULL) ? checkinteger(second(args)) : top;
+  }
+  screeninvalidate(top, bottom);
+  return nil;
+}
+
+/*
+  (screen-highlight on)
+  Turns syntax colouring of the editor text on or off, and marks the text area for a redraw.
+*/
+object *fn_ScreenHighlight (object *args, object *env) {
+  (void) env;
+  ScreenHighlight = (first(args) != nil);
+  screeninvalidate(0, 0x7FFF);
+  return ScreenHighlight ? tee : nil;
+}
+
+/*
+  (screen-refresh ox oy)
+  Brings the editor text area up to date with the buffer scrolled to column ox and line oy.
+*/
+object *fn_ScreenRefresh (object *args, object *env) {
+  (void) env;
+  uint32_t start = micros();
+  screenrefresh(checkinteger(first(args)), checkinteger(second(args)));
+  Perf.section[PERF_REFRESH] += micros() - start;
+  return nil;
+}
+
+/*
+  (screen-scroll on)
+  Turns hardware scrolling of the text area on or off. Returns nil if the display is in
+  portrait, where the ST7789 can't scroll the text sideways.
+*/
+object *fn_ScreenScroll (object *args, object *env) {
+  (void) env;
+  bool on = (first(args) != nil) && tft.width() > tft.height();
+  scrollreset();
+  if (on) scrolldefine();
+  ScrollOn = on;
+  return on ? tee : nil;
+}
+
+/*
+  (screen-overlay)
+  Flushes the display list and puts the hardware scroll back, ready to draw over the
+  text area with the graphics functions.
+*/
+object *fn_ScreenOverlay (object *args, object *env) {
+  (void) args, (void) env;
+  displayflush();
+  scrollreset();
+  return nil;
+}
+
+/*
+  (screen-restore col row [gutter])
+  Redraws the character at column col of text row row as the renderer last drew it,
+  undoing anything drawn over it, and the row's line number too if gutter is true.
+  Returns nil if the row is already due for a full redraw.
+*/
+object *fn_ScreenRestore (object *args, object *env) {
+  (void) env;
+  int c = checkinteger(first(args)), r = checkinteger(second(args));
+  if (r < 0 || r >= ScreenRows || !ScreenValid[r]) return nil;
+  int ry = ScreenY + r*SCREEN_LEADING;
+  uint16_t fg[SCREEN_GUTTER], bg[SCREEN_GUTTER];
+  for (int i = 0; i < SCREEN_GUTTER; i++) bg[i] = Palette[PAL_BG];
+  if (c >= 0 && c < ScreenCols) {
+    fg[0] = Palette[ScreenColour[r][c]];
+    displaytext(ScreenX + c*SCREEN_CWIDTH, ry, &ScreenText[r][c], fg, bg, 1);
+  }
+  if (cddr(args) != NULL && third(args) != nil) {
+    char buf[SCREEN_GUTTER + 1];
+    if (ScreenLine[r]) snprintf(buf, SCREEN_GUTTER + 1, "%-*d", SCREEN_GUTTER, ScreenLine[r]);
+    else memset(buf, ' ', SCREEN_GUTTER);
+    for (int i = 0; i < SCREEN_GUTTER; i++) fg[i] = Palette[PAL_LINE];
+    displaytext(0, ry, buf, fg, bg, SCREEN_GUTTER);
+  }
+  return tee;
+}
+#endif
+
+// String search
+
+/*
+  The pattern and target are copied out of their string cells once, so reading
+  a character is an array access rather than a walk along the cells with
+  nthchar, and the search uses Horspool's skip table.
+*/
+
+// Copy a Lisp string into a malloc'd buffer; the caller frees it
+char *flatstring (object *string, int *len) {
+  int n = stringlength(string);
+  char *buf = (char *)malloc(n + 1);
+  if (buf == NULL) error2("not enough memory for search");
+  cstring(string, buf, n + 1);
+  *len = n;
+  return buf;
+}
+
+inline uint8_t foldchar (char c, bool fold) {
+  return fold ? tolower(c) : (uint8_t)c;
+}
+
+// Fill in the Horspool shift for each character, for searching for p forwards
+void searchtable (int *skip, const char *p, int m, bool fold) {
+  for (int c = 0; c < 256; c++) skip[c] = m;
+  for (int i = 0; i < m - 1; i++) skip[foldchar(p[i], fold)] = m - 1 - i;
+}
+
+// Index of the first occurrence of p at or after start in t, or -1, with skip from searchtable
+int searchskipping (const char *p, int m, const int *skip, const char *t, int n, int start, bool fold) {
+  if (m == 0) return start;
+  for (int i = start; i <= n - m; i = i + skip[foldchar(t[i + m - 1], fold)]) {
+    int j = m - 1;
+    while (j >= 0 && foldchar(t[i + j], fold) == foldchar(p[j], fold)) j--;
+    if (j < 0) return i;
+  }
+  return -1;
+}
+
+// Index of the first occurrence of p at or after start in t, or -1
+int searchforward (const char *p, int m, const char *t, int n, int start, bool fold) {
+  int skip[256];
+  searchtable(skip, p, m, fold);
+  return searchskipping(p, m, skip, t, n, start, fold);
+}
+
+// Index of the last occurrence of p that ends at or before end in t, or -1
+int searchbackward (const char *p, int m, const char *t, int end, bool fold) {
+  if (m == 0) return end;
+  int skip[256];
+  for (int c = 0; c < 256; c++) skip[c] = m;
+  for (int i = m - 1; i > 0; i--) skip[foldchar(p[i], fold)] = i;
+  for (int i = end - m; i >= 0; i = i - skip[foldchar(t[i], fold)]) {
+    int j = 0;
+    while (j < m && foldchar(t[i + j], fold) == foldchar(p[j], fold)) j++;
+    if (j == m) return i;
+  }
+  return -1;
+}
+
+object *searchstr (object *args, bool fold, bool backward) {
+  object *pattern = first(args);
+  object *target = second(args);
+  args = cddr(args);
+  if (pattern == NULL && !backward) return number(0);
+  else if (target == NULL) return nil;
+  if (!stringp(target) || (pattern != NULL && !stringp(pattern))) error2("arguments are not both lists or strings");
+  int n = stringlength(target);
+  int pos = backward ? n : 0;
+  if (args != NULL) pos = checkinteger(car(args));
+  if (pos < 0 || pos > n) error2(indexrange);
+  if (pattern == NULL) return number(pos);
+  int m;
+  char *p = flatstring(pattern, &m);
+  char *t = flatstring(target, &n);
+  int i = backward ? searchbackward(p, m, t, pos, fold) : searchforward(p, m, t, n, pos, fold);
+  free(p); free(t);
+  return (i < 0) ? nil : number(i);
+}
+
+/*
+  (search-str pattern target [startpos])
+  Returns the index of the first occurrence of pattern in target at or after startpos, or nil.
+*/
+object *fn_searchstr (object *args, object *env) {
+  (void) env;
+  return searchstr(args, false, false);
+}
+
+/*
+  (search-str-ci pattern target [startpos])
+  Like search-str, but ignores the case of letters.
+*/
+object *fn_searchstrci (object *args, object *env) {
+  (void) env;
+  return searchstr(args, true, false);
+}
+
+/*
+  (search-str-back pattern target [endpos])
+  Returns the index of the last occurrence of pattern in target that ends at or before endpos, or nil.
+*/
+object *fn_searchstrback (object *args, object *env) {
+  (void) env;
+  return searchstr(args, false, true);
+}
+
+// String toolkit
+
+/*
+  Splitting, joining and building strings in one pass, so each result string is
+  built cell by cell exactly once rather than copied by repeated concatenate.
+*/
+
+#define STRINGBUILDERS 4
+
+typedef struct {
+  char *text;
+  int len;
+  int cap;
+  bool used;
+} stringbuilder_t;
+
+stringbuilder_t StringBuilders[STRINGBUILDERS];
+
+object *stringfrom (const char *text, int start, int end) {
+  object *obj = newstring();
+  object *tail = obj;
+  for (int i = start; i < end; i++) buildstring(text[i], &tail);
+  return obj;
+}
+
+// Append the characters of a Lisp string to another, walking its cells once
+void buildfrom (object *string, object **tail) {
+  for (object *cell = cdr(string); cell != NULL; cell = car(cell)) {
+    for (int shift = (sizeof(int) - 1)*8; shift >= 0; shift = shift - 8) {
+      char c = (cell->chars >> shift) & 0xFF;
+      if (c) buildstring(c, tail);
+    }
+  }
+}
+
+stringbuilder_t *checkbuilder (object *arg) {
+  int i = checkinteger(arg);
+  if (i < 0 || i >= STRINGBUILDERS || !StringBuilders[i].used) error2("not a string builder");
+  return &StringBuilders[i];
+}
+
+void builderreserve (stringbuilder_t *sb, int n) {
+  if (sb->len + n > sb->cap) {
+    int cap = (sb->cap == 0) ? 64 : sb->cap;
+    while (cap < sb->len + n) cap = cap * 2;
+    char *buf = (char *)realloc(sb->text, cap);
+    if (buf == NULL) error2("not enough memory for string builder");
+    sb->text = buf;
+    sb->cap = cap;
+  }
+}
+
+void builderadd (stringbuilder_t *sb, const char *text, int n) {
+  builderreserve(sb, n);
+  memcpy(&sb->text[sb->len], text, n);
+  sb->len = sb->len + n;
+}
+
+// Append a string, character or integer to a builder
+void builderaddobject (stringbuilder_t *sb, object *item) {
+  if (stringp(item)) {
+    builderreserve(sb, stringlength(item));
+    for (object *cell = cdr(item); cell != NULL; cell = car(cell)) {
+      for (int shift = (sizeof(int) - 1)*8; shift >= 0; shift = shift - 8) {
+        char c = (cell->chars >> shift) & 0xFF;
+        if (c) sb->text[sb->len++] = c;
+      }
+    }
+  } else if (characterp(item)) {
+    char c = checkchar(item);
+    builderadd(sb, &c, 1);
+  } else if (integerp(item)) {
+    char buf[12];
+    builderadd(sb, buf, snprintf(buf, sizeof(buf), "%d", item->integer));
+  } else error2("argument is not a string, character or integer");
+}
+
+/*
+  (string-split delim string)
+  Returns a list of the parts of string separated by delim.
+*/
+object *fn_StringSplit (object *args, object *env) {
+  (void) env;
+  object *delim = checkstring(first(args));
+  object *str = checkstring(second(args));
+  int m, n;
+  char *d = flatstring(delim, &m);
+  char *t = flatstring(str, &n);
+  int skip[256];
+  searchtable(skip, d, m, false);
+  object *result = cons(NULL, NULL);
+  object *ptr = result;
+  int start = 0;
+  for (;;) {
+    int end = (m == 0) ? -1 : searchskipping(d, m, skip, t, n, start, false);
+    cdr(ptr) = cons(stringfrom(t, start, (end < 0) ? n : end), NULL);
+    ptr = cdr(ptr);
+    if (end < 0) break;
+    start = end + m;
+  }
+  free(d); free(t);
+  return cdr(result);
+}
+
+/*
+  (string-join list [separator])
+  Returns the strings or characters in list joined into one string, with separator between them.
+*/
+object *fn_StringJoin (object *args, object *env) {
+  (void) env;
+  object *list = first(args);
+  object *sep = (cdr(args) != NULL) ? checkstring(second(args)) : NULL;
+  object *obj = newstring();
+  object *tail = obj;
+  for (; list != NULL; list = cdr(list)) {
+    object *item = car(list);
+    if (characterp(item)) buildstring(checkchar(item), &tail);
+    else buildfrom(checkstring(item), &tail);
+    if (sep != NULL && cdr(list) != NULL) buildfrom(sep, &tail);
+  }
+  return obj;
+}
+
+/*
+  (string-builder)
+  Returns a new, empty string builder.
+*/
+object *fn_StringBuilder (object *args, object *env) {
+  (void) args, (void) env;
+  for (int i = 0; i < STRINGBUILDERS; i++) {
+    if (!StringBuilders[i].used) {
+      StringBuilders[i].used = true;
+      StringBuilders[i].len = 0;
+      return number(i);
+    }
+  }
+  error2("too many string builders");
+  return nil;
+}
+
+/*
+  (string-builder-append builder item*)
+  Appends strings, characters or integers to a string builder.
+*/
+object *fn_StringBuilderAppend (object *args, object *env) {
+  (void) env;
+  object *builder = first(args);
+  stringbuilder_t *sb = checkbuilder(builder);
+  for (args = cdr(args); args != NULL; args = cdr(args)) builderaddobject(sb, car(args));
+  return builder;
+}
+
+/*
+  (string-builder-string builder)
+  Returns the contents of a string builder as a string, and frees the builder.
+*/
+object *fn_StringBuilderString (object *args, object *env) {
+  (void) env;
+  stringbuilder_t *sb = checkbuilder(first(args));
+  object *obj = stringfrom(sb->text, 0, sb->len);
+  free(sb->text);
+  sb->text = NULL;
+  sb->len = sb->cap = 0;
+  sb->used = false;
+  return obj;
+}
+
+// Objects
+
+/*
+  Native gtv, stv and cmt for the object system in LispLibrary.h. An object is
+  still an association list of slots, with an optional parent slot holding the
+  parent object or a symbol bound to it, so class and adp work on it unchanged.
+
+  A slot not on the object itself is looked up through its parent, and the slot
+  cell found is cached by (parent, slot), so methods and defaults on a class
+  resolve once rather than through an eval and a scan every call. Entries are
+  bare workspace pointers, so the cache is emptied after each garbage collection:
+  SlotCanary is an unreachable cell that points to itself until the collector
+  frees it. An entry reached through a parent named by a symbol is only used
+  while the symbol still has the value it had when the entry was made.
+*/
+
+#define SLOT_CACHE 64   // a power of 2
+#define SLOT_DEPTH 16   // parents followed before giving up
+
+typedef struct {
+  object *parent;       // the parent slot's value: an object, or a symbol bound to one
+  symbol_t name;
+  object *pair;         // the (slot . value) cell found
+  object *binding;      // when parent is a symbol, its binding and the value it had
+  object *value;
+} slotentry_t;
+
+slotentry_t SlotCache[SLOT_CACHE];
+object *SlotCanary = NULL;
+symbol_t SlotParentName = 0;
+bool SlotParentKnown = false;
+
+void slotcacheclear () {
+  memset(SlotCache, 0, sizeof(SlotCache));
+}
+
+void slotcachecheck () {
+  if (SlotCanary != NULL && car(SlotCanary) == SlotCanary && cdr(SlotCanary) == SlotCanary) return;
+  slotcacheclear();
+  SlotCanary = myalloc();
+  car(SlotCanary) = SlotCanary;
+  cdr(SlotCanary) = SlotCanary;
+}
+
+bool slotisparent (object *key) {
+  if (!symbolp(key)) return false;
+  if (SlotParentKnown) return key->name == SlotParentName;
+  if (strcmp(symbolname(key->name), "parent") != 0) return false;
+  SlotParentName = key->name;
+  SlotParentKnown = true;
+  return true;
+}
+
+// The object obj stands for, evaluating it if it's a symbol
+object *slotobject (object *obj, object **binding) {
+  *binding = NULL;
+  if (!symbolp(obj)) return obj;
+  *binding = findpair(obj, NULL);
+  if (*binding == NULL) error("undefined", obj);
+  return cdr(*binding);
+}
+
+// The (slot . value) cell on obj itself; sets *parent to the parent slot's value if obj has one
+object *slotown (object *obj, object *slot, object **parent) {
+  *parent = NULL;
+  for (object *list = obj; consp(list); list = cdr(list)) {
+    object *pair = car(list);
+    if (!consp(pair)) continue;
+    if (eq(car(pair), slot)) return pair;
+    if (*parent == NULL && slotisparent(car(pair))) *parent = cdr(pair);
+  }
+  return NULL;
+}
+
+// The (slot . value) cell for slot in obj or its parents, or NULL
+object *slotfind (object *obj, object *slot) {
+  object *binding, *parent;
+  obj = slotobject(obj, &binding);
+  object *pair = slotown(obj, slot, &parent);
+  if (pair != NULL || parent == NULL) return pair;
+
+  slotcachecheck();
+  slotentry_t *entry = NULL;
+  if (symbolp(slot)) {
+    entry = &SlotCache[((uintptr_t)parent/sizeof(object) ^ slot->name) & (SLOT_CACHE - 1)];
+    if (entry->pair != NULL && entry->parent == parent && entry->name == slot->name
+      && (entry->binding == NULL || cdr(entry->binding) == entry->value)) return entry->pair;
+  }
+  // Walk the parents; the result is only cached if no symbol but the first had to be evaluated
+  object *first = parent, *firstbinding = NULL, *firstvalue = NULL;
+  bool cacheable = true;
+  for (int depth = 0; depth < SLOT_DEPTH && parent != NULL; depth++) {
+    obj = slotobject(parent, &binding);
+    if (depth == 0) { firstbinding = binding; firstvalue = obj; }
+    else if (binding != NULL) cacheable = false;
+    pair = slotown(obj, slot, &parent);
+    if (pair != NULL) break;
+  }
+  if (pair != NULL && entry != NULL && cacheable) {
+    entry->parent = first; entry->name = slot->name; entry->pair = pair;
+    entry->binding = firstbinding; entry->value = firstvalue;
+  }
+  return pair;
+}
+
+/*
+  (gtv obj slot)
+  Returns the value of slot in obj, an object or a symbol bound to one, or in its parents.
+*/
+object *fn_gtv (object *args, object *env) {
+  (void) env;
+  object *pair = slotfind(first(args), second(args));
+  return (pair != NULL) ? cdr(pair) : nil;
+}
+
+/*
+  (stv obj slot value)
+  Sets slot in obj itself to value, and returns value, or nil if obj has no such slot.
+*/
+object *fn_stv (object *args, object *env) {
+  (void) env;
+  object *binding, *parent;
+  object *obj = slotobject(first(args), &binding);
+  object *slot = second(args), *value = third(args);
+  object *pair = slotown(obj, slot, &parent);
+  if (pair == NULL) return nil;
+  if (slotisparent(slot)) slotcacheclear();
+  cdr(pair) = value;
+  return value;
+}
+
+/*
+  (cmt obj method [arguments]*)
+  Calls the function in slot method of obj or its parents, with obj and the arguments.
+*/
+object *fn_cmt (object *args, object *env) {
+  (void) env;
+  object *obj = first(args), *method = second(args);
+  object *pair = slotfind(obj, method);
+  if (pair == NULL) error("no such method", method);
+  object *function = cdr(pair);
+  // A lambda list in the slot, or #' of one, is applied as it is rather than made into a closure each call
+  if (consp(function) && isbuiltin(car(function), FUNCTION) && consp(cdr(function))
+    && consp(second(function)) && isbuiltin(car(second(function)), LAMBDA)) function = second(function);
+  else if (!(consp(function) && isbuiltin(car(function), LAMBDA))) function = eval(function, NULL);
+  protect(function);
+  object *arguments = cons(obj, cddr(args));
+  unprotect();
+  return apply(function, arguments, NULL);
+}
+
+#if defined sdcardsupport
+// SD card
+
+/*
+  The card is mounted once and stays mounted. It is remounted when it reports no
+  card, or when an open fails and the root can't be opened either, which covers a
+  card that was swapped; a file that just isn't there leaves the mount alone.
+  Remounting closes every open file, so it is never done while the text buffer is
+  still being read from one. Paths are converted into one scratch buffer rather
+  than a malloc each.
+*/
+
+#define SD_SECTOR 512
+#define SD_PATH   64
+
+bool SDMounted = false;
+char SDPath[SD_PATH+1];
+
+bool sdmount () {
+  if (SDMounted && SD.cardType() != CARD_NONE) return true;
+  if (TextLoading) return false;
+  SD.end();
+  SDMounted = SD.begin(TDECK_SDCARD_CS);
+  return SDMounted;
+}
+
+// The path in a Lisp string, with a leading / added if it has none
+char *sdpath (object *arg) {
+  checkstring(arg);
+  if (stringlength(arg) > 0 && nthchar(arg, 0) == '/') cstring(arg, SDPath, SD_PATH+1);
+  else { SDPath[0] = '/'; cstring(arg, &SDPath[1], SD_PATH); }
+  return SDPath;
+}
+
+File sdopen (const char *path, const char *mode) {
+  if (!sdmount()) error2("no SD card");
+  File file = SD.open(path, mode);
+  if (!file && !TextLoading) {
+    File root = SD.open("/");
+    if (root) root.close();
+    else {
+      SDMounted = false;
+      if (sdmount()) file = SD.open(path, mode);
+    }
+  }
+  return file;
+}
+
+/*
+  (sd-file-exists filename)
+  Returns t if filename exists on SD card, otherwise nil.
+*/
+object *fn_SDFileExists (object *args, object *env) {
+  (void) env;
+  char *path = sdpath(first(args));
+  if (!sdmount()) return nil;
+  return SD.exists(path) ? tee : nil;
+}
+
+/*
+  (sd-file-remove filename)
+  Returns t if filename exists on SD card, otherwise nil.
+*/
+object *fn_SDFileRemove (object *args, object *env) {
+  (void) env;
+  char *path = sdpath(first(args));
+  if (!sdmount()) return nil;
+  return SD.remove(path) ? tee : nil;
+}
+
+object *fn_directory2(object *args, object *env) {
+  (void) env;
+  object *result = cons(NULL, NULL);
+  object *ptr = result;
+  textload(INT_MAX);
+  File root = sdopen((args != NULL) ? sdpath(first(args)) : "/", FILE_READ);
+  if (!root) return nil;
+
+  while (true) {
+    File entry =  root.openNextFile();
+    if (!entry) break; // no more files
+    object *filename = lispstring((char*)entry.name());
+    if (entry.isDirectory()) {
+      cdr(ptr) = cons(filename, NULL);
+    }else{
+      cdr(ptr) = cons(cons(filename, number(entry.size())), NULL);
+    }
+    ptr = cdr(ptr);
+    entry.close();
+  }
+  
+  root.close();
+  return cdr(result);
+}
+
+#define DIR_MAXDEPTH 3   // each level and the entry hold a file open, and the SD library allows 5
+
+/*
+  (dir-walk [directory] [depth] [offset] [limit] [details])
+  Walks directory, default the root, and the directories in it down to depth levels,
+  listing entries depth first. Skips the first offset entries and stops reading after
+  limit more, so a page costs no more than the entries up to it. Each entry is
+  (level name size), with size nil for a directory, or (level name size mtime) if details.
+  A walk to the full depth uses every file the SD library allows, and a file that can't
+  be opened reads as the end of its directory, so the rest of the text buffer is loaded
+  first to close the file it is being read from.
+*/
+object *fn_DirWalk (object *args, object *env) {
+  (void) env;
+  File dirs[DIR_MAXDEPTH + 1];
+  const char *path = "/";
+  int depth = 0, offset = 0, limit = INT_MAX;
+  bool details = false;
+  if (args != NULL) {
+    if (first(args) != nil) path = sdpath(first(args));
+    args = cdr(args);
+  }
+  if (args != NULL) { depth = min(max(checkinteger(first(args)), 0), DIR_MAXDEPTH); args = cdr(args); }
+  if (args != NULL) { offset = max(checkinteger(first(args)), 0); args = cdr(args); }
+  if (args != NULL) { limit = max(checkinteger(first(args)), 0); args = cdr(args); }
+  if (args != NULL) details = (first(args) != nil);
+
+  textload(INT_MAX);
+  dirs[0] = sdopen(path, FILE_READ);
+  if (!dirs[0]) return nil;
+  object *result = cons(NULL, NULL);
+  object *ptr = result;
+  int level = 0, count = 0;
+  while (level >= 0 && count - offset < limit) {
+    File entry = dirs[level].openNextFile();
+    if (!entry) {
+      dirs[level--].close();
+      continue;
+    }
+    if (count++ >= offset) {
+      object *item = nil;
+      if (details) item = cons(number(entry.getLastWrite()), nil);
+      item = cons(entry.isDirectory() ? nil : number(entry.size()), item);
+      item = cons(number(level), cons(lispstring((char*)entry.name()), item));
+      cdr(ptr) = cons(item, NULL);
+      ptr = cdr(ptr);
+    }
+    if (entry.isDirectory() && level < depth) dirs[++level] = entry;
+    else entry.close();
+  }
+  while (level >= 0) dirs[level--].close();
+  return cdr(result);
+}
+
+/*
+  (sd-read-lines filename)
+  Replaces the text buffer with the lines of filename, reading only the start of the
+  file; the rest is read as the buffer is used. Returns nil if the file can't be opened.
+*/
+object *fn_SDReadLines (object *args, object *env) {
+  (void) env;
+  File file = sdopen(sdpath(first(args)), FILE_READ);
+  if (!file) return nil;
+  textclear();
+  TextFile = file;
+  TextLoading = true;
+  textload(0);
+  return tee;
+}
+
+/*
+  (sd-write-lines filename)
+  Writes the text buffer to filename, a line per buffer line, through a sector-sized
+  buffer. The text goes to a temporary file that then replaces filename, so an interrupted
+  save leaves the old file intact. Returns (bytes . milliseconds).
+*/
+object *fn_SDWriteLines (object *args, object *env) {
+  (void) env;
+  static uint8_t buffer[SD_SECTOR];
+  char path[SD_PATH+1], temp[SD_PATH+5], backup[SD_PATH+5];
+  uint32_t start = millis(), bytes = 0;
+  int fill = 0;
+  strcpy(path, sdpath(first(args)));
+  snprintf(temp, sizeof(temp), "%s.tmp", path);
+  snprintf(backup, sizeof(backup), "%s.bak", path);
+
+  textload(INT_MAX);
+  if (TextIncomplete) error2("the file wasn't read in full, so the buffer can't be saved");
+  File file = sdopen(temp, FILE_WRITE);
+  if (!file) error2("couldn't create file");
+  for (int y = 0; y < textcount(); y++) {
+    textline_t *line = textline(y);
+    for (int i = 0; i <= line->len; i++) {
+      buffer[fill++] = (i < line->len) ? line->text[i] : '\n';
+      if (fill == SD_SECTOR) {
+        if (file.write(buffer, fill) != (size_t)fill) { file.close(); SD.remove(temp); error2("write failed"); }
+        bytes = bytes + fill; fill = 0;
+      }
+    }
+  }
+  if (fill > 0) {
+    if (file.write(buffer, fill) != (size_t)fill) { file.close(); SD.remove(temp); error2("write failed"); }
+    bytes = bytes + fill;
+  }
+  file.close();
+
+  // FAT can't rename over a file, so keep the old one as a backup until the new one is in place
+  if (SD.exists(backup)) SD.remove(backup);
+  if (SD.exists(path) && !SD.rename(path, backup)) { SD.remove(temp); error2("couldn't replace file"); }
+  if (!SD.rename(temp, path)) { SD.rename(backup, path); error2("couldn't replace file"); }
+  SD.remove(backup);
+  Perf.sdwritten += bytes;
+  return cons(number(bytes), number(millis() - start));
+}
+
+#endif
+
+// Library image
+
+/*
+  LispLibrary is evaluated from source at every reset. Its first form is
+  (library-image), which loads a saved image of the workspace instead if there is
+  one for this library and this build, and then moves the library reader to the
+  end of the source so the rest is skipped. Otherwise the source is evaluated as
+  before, and the last form, (library-image t), saves the result for next time.
+
+  LIBRARY.SUM holds the key the image was made for, a CRC of the library source and
+  the build time, and a CRC of the image file, so a stale or damaged image is never
+  loaded. The image itself is written and read by the core's save-image and load-image.
+*/
+
+#define LIBRARY_IMAGE "LIBRARY.IMG"
+#define LIBRARY_SUM   "/LIBRARY.SUM"
+
+uint32_t crc32 (uint32_t crc, const uint8_t *data, size_t n) {
+  crc = ~crc;
+  while (n--) {
+    crc = crc ^ *data++;
+    for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+#if defined(lisplibrary)
+uint32_t librarykey () {
+  static const char build[] = __DATE__ " " __TIME__;
+  uint32_t crc = crc32(0, (const uint8_t *)LispLibrary, strlen(LispLibrary));
+  return crc32(crc, (const uint8_t *)build, strlen(build));
+}
+
+#if defined sdcardsupport
+// CRC of the image file, or 0 if it can't be read
+uint32_t libraryimagecrc () {
+  static uint8_t buffer[SD_SECTOR];
+  File file = sdopen("/" LIBRARY_IMAGE, FILE_READ);
+  if (!file) return 0;
+  uint32_t crc = 0;
+  int n;
+  while ((n = file.read(buffer, SD_SECTOR)) > 0) crc = crc32(crc, buffer, n);
+  file.close();
+  return crc;
+}
+#endif
+#endif
+
+/*
+  (library-image [save])
+  With save true, saves the workspace as the library image and returns t. Otherwise
+  loads the library image if it is current, skips the rest of the library source and
+  returns t, or returns nil if there is no current image.
+*/
+object *fn_LibraryImage (object *args, object *env) {
+  (void) env;
+  #if defined(sdcardsupport) && defined(lisplibrary)
+  uint32_t key = librarykey();
+  if (!sdmount()) return nil;
+  if (args != NULL && first(args) != nil) {
+    SD.remove(LIBRARY_SUM);
+    saveimage(lispstring((char *)LIBRARY_IMAGE));
+    char sum[24];
+    int n = snprintf(sum, sizeof(sum), "%08x %08x\n", (unsigned int)key, (unsigned int)libraryimagecrc());
+    File file = sdopen(LIBRARY_SUM, FILE_WRITE);
+    if (!file) return nil;
+    file.write((uint8_t *)sum, n);
+    file.close();
+    return tee;
+  }
+  char sum[24] = { 0 };
+  unsigned int savedkey, savedcrc;
+  File file = sdopen(LIBRARY_SUM, FILE_READ);
+  if (!file) return nil;
+  file.read((uint8_t *)sum, sizeof(sum) - 1);
+  file.close();
+  if (sscanf(sum, "%x %x", &savedkey, &savedcrc) != 2 || savedkey != key) return nil;
+  if (libraryimagecrc() != savedcrc) return nil;
+  loadimage(lispstring((char *)LIBRARY_IMAGE));
+  GlobalStringIndex = strlen(LispLibrary);
+  LastChar = 0;
+  return tee;
+  #else
+  (void) args;
+  return nil;
+  #endif
+}
+
+// Modules
+
+/*
+  Parts of the Lisp Library that only some sessions need are kept in LispLibrary.h
+  as separate source strings, and evaluated the first time they're used, from a
+  stub in the library. module-load notes every symbol the module's source defines
+  with defun or defvar, at any depth, so module-unload can remove those bindings
+  again and leave the space to the garbage collector.
+*/
+
+#if defined(lisplibrary)
+typedef struct {
+  const char *name;
+  const char *text;
+  symbol_t *names;   // symbols defined by the module, malloc'd
+  int count, cap;
+  bool loaded;
+} module_t;
+
+module_t Modules[] = {
+  { "editor", LispEditor, NULL, 0, 0, false }
+};
+
+const char *ModuleText = NULL;
+int ModuleIndex = 0;
+
+int gmodule () {
+  if (LastChar) {
+    char temp = LastChar;
+    LastChar = 0;
+    return temp;
+  }
+  char c = ModuleText[ModuleIndex++];
+  return (c != 0) ? c : -1;
+}
+
+module_t *checkmodule (object *arg) {
+  if (!symbolp(arg)) error(notasymbol, arg);
+  const char *name = symbolname(arg->name);
+  for (int i = 0; i < (int)arraysize(Modules); i++) {
+    if (strcmp(Modules[i].name, name) == 0) return &Modules[i];
+  }
+  error("unknown module", arg);
+  return NULL;
+}
+
+bool moduleowns (module_t *m, symbol_t name) {
+  for (int i = 0; i < m->count; i++) if (m->names[i] == name) return true;
+  return false;
+}
+
+void moduleadd (module_t *m, symbol_t name) {
+  if (moduleowns(m, name)) return;
+  if (m->count == m->cap) {
+    int cap = m->cap ? 2*m->cap : 32;
+    symbol_t *names = (symbol_t *)realloc(m->names, cap*sizeof(symbol_t));
+    if (names == NULL) error2("not enough memory for module");
+    m->names = names; m->cap = cap;
+  }
+  m->names[m->count++] = name;
+}
+
+// Note the symbols defined anywhere in form
+void modulescan (module_t *m, object *form) {
+  if (!consp(form)) return;
+  if ((isbuiltin(car(form), DEFUN) || isbuiltin(car(form), DEFVAR)) && consp(cdr(form)) && symbolp(second(form))) {
+    moduleadd(m, second(form)->name);
+  }
+  for (; consp(form); form = cdr(form)) modulescan(m, car(form));
+}
+
+/*
+  (module-load name)
+  Evaluates the source of the library module name, unless it's already loaded.
+  Returns t if it was loaded now, or nil if it already was.
+*/
+object *fn_ModuleLoad (object *args, object *env) {
+  (void) env;
+  module_t *m = checkmodule(first(args));
+  if (m->loaded) return nil;
+  const char *text = ModuleText;
+  int index = ModuleIndex;
+  char last = LastChar;
+  ModuleText = m->text; ModuleIndex = 0; LastChar = 0;
+  object *form = read(gmodule);
+  while (form != NULL) {
+    protect(form);
+    modulescan(m, form);
+    eval(form, NULL);
+    unprotect();
+    form = read(gmodule);
+  }
+  ModuleText = text; ModuleIndex = index; LastChar = last;
+  m->loaded = true;
+  return tee;
+}
+
+/*
+  (module-unload name)
+  Removes the global definitions made by the library module name, so the space they
+  take can be collected, and returns how many there were.
+*/
+object *fn_ModuleUnload (object *args, object *env) {
+  (void) env;
+  module_t *m = checkmodule(first(args));
+  int removed = 0;
+  object **ptr = &GlobalEnv;
+  while (*ptr != NULL) {
+    object *pair = car(*ptr);
+    if (consp(pair) && symbolp(car(pair)) && moduleowns(m, car(pair)->name)) { *ptr = cdr(*ptr); removed++; }
+    else ptr = &cdr(*ptr);
+  }
+  free(m->names);
+  m->names = NULL; m->count = 0; m->cap = 0;
+  m->loaded = false;
+  return number(removed);
+}
+#endif
+
+
+// Symbol names
+const char string_gettouchpoints[] PROGMEM = "get-touch-points";
+const char stringKeyboardGetKey[] PROGMEM = "keyboard-get-key";
+const char stringKeyboardFlush[] PROGMEM = "keyboard-flush";
+const char stringInputEvents[] PROGMEM = "input-events";
+const char stringKeyboardGetText[] PROGMEM = "keyboard-get-text";
+const char stringInputSteps[] PROGMEM = "input-steps";
+const char stringTouchHistory[] PROGMEM = "touch-history";
+const char stringPerfCounters[] PROGMEM = "perf-counters";
+const char stringPerfLast[] PROGMEM = "perf-last";
+const char stringLibraryImage[] PROGMEM = "library-image";
+#if defined(lisplibrary)
+const char stringModuleLoad[] PROGMEM = "module-load";
+const char stringModuleUnload[] PROGMEM = "module-unload";
+#endif
+const char stringSearchStr[] PROGMEM = "search-str";
+const char stringSearchStrCi[] PROGMEM = "search-str-ci";
+const char stringSearchStrBack[] PROGMEM = "search-str-back";
+const char stringStringSplit[] PROGMEM = "string-split";
+const char stringStringJoin[] PROGMEM = "string-join";
+const char stringStringBuilder[] PROGMEM = "string-builder";
+const char stringStringBuilderAppend[] PROGMEM = "string-builder-append";
+const char stringStringBuilderString[] PROGMEM = "string-builder-string";
+const char stringBufferClear[] PROGMEM = "buffer-clear";
+const char stringBufferLines[] PROGMEM = "buffer-lines";
+const char stringBufferMove[] PROGMEM = "buffer-move";
+const char stringBufferLine[] PROGMEM = "buffer-line";
+const char stringBufferLineLength[] PROGMEM = "buffer-line-length";
+const char stringBufferChar[] PROGMEM = "buffer-char";
+const char stringBufferInsert[] PROGMEM = "buffer-insert";
+const char stringBufferDelete[] PROGMEM = "buffer-delete";
+const char stringBufferSplitLine[] PROGMEM = "buffer-split-line";
+const char stringBufferJoinLines[] PROGMEM = "buffer-join-lines";
+const char stringBufferAddLine[] PROGMEM = "buffer-add-line";
+const char stringBufferFromList[] PROGMEM = "buffer-from-list";
+const char stringBufferToList[] PROGMEM = "buffer-to-list";
+const char stringBufferUndo[] PROGMEM = "buffer-undo";
+const char stringBufferRedo[] PROGMEM = "buffer-redo";
+const char stringBufferJournalSize[] PROGMEM = "buffer-journal-size";
+const char stringBracketPartner[] PROGMEM = "bracket-partner";
+const char stringPaletteLoad[] PROGMEM = "palette-load";
+const char stringPalette[] PROGMEM = "palette";
+const char stringgtv[] PROGMEM = "gtv";
+const char stringstv[] PROGMEM = "stv";
+const char stringcmt[] PROGMEM = "cmt";
+#if defined(gfxsupport)
+const char stringScreenSetup[] PROGMEM = "screen-setup";
+const char stringScreenInvalidate[] PROGMEM = "screen-invalidate";
+const char stringScreenRefresh[] PROGMEM = "screen-refresh";
+const char stringScreenHighlight[] PROGMEM = "screen-highlight";
+const char stringScreenScroll[] PROGMEM = "screen-scroll";
+const char stringScreenOverlay[] PROGMEM = "screen-overlay";
+const char stringScreenRestore[] PROGMEM = "screen-restore";
+const char stringDrawTextRun[] PROGMEM = "draw-text-run";
+const char stringDisplayList[] PROGMEM = "display-list";
+const char stringDisplayFlush[] PROGMEM = "display-flush";
+#endif
+
+#if defined sdcardsupport
+const char stringSDFileExists[] PROGMEM = "sd-file-exists";
+const char stringSDFileRemove[] PROGMEM = "sd-file-remove";
+
+const char stringDir2[] PROGMEM = "dir2";
+const char stringDirWalk[] PROGMEM = "dir-walk";
+const char stringSDWriteLines[] PROGMEM = "sd-write-lines";
+const char stringSDReadLines[] PROGMEM = "sd-read-lines";
+#endif
+
+
+// Documentation strings
+const char doc_gettouchpoints[] PROGMEM = "(get-touch-points)\n"
+"Returns all the points being touched on the screen in a list of x,y pairs or an empty list.\n"
+"Does not wait for the touch to end.";
+
+const char docKeyboardGetKey[] PROGMEM = "(keyboard-get-key [pressed [gestures]])\n"
+"Get key last recognized - default: when released, if [pressed] is t: when pressed).\n"
+"Gesture codes, 256 and up, are skipped unless gestures is t.";
+const char docKeyboardFlush[] PROGMEM = "(keyboard-flush)\n"
+"Discard the queued keys, trackball moves and gestures.";
+const char docInputEvents[] PROGMEM = "(input-events [max])\n"
+"Returns up to max of the queued keyboard, trackball and gesture events, oldest\n"
+"first. Each is (code milliseconds), or (code milliseconds x y value) for a gesture:\n"
+"256 tap, 257 long press, 258-261 swipe up, down, left, right, 262 two-finger tap.\n"
+"The value is the duration in ms, or the velocity in pixels/s for a swipe.";
+const char docKeyboardGetText[] PROGMEM = "(keyboard-get-text [max] [stop])\n"
+"Returns the printable keys queued after the last one from keyboard-get-key as a string,\n"
+"up to max characters, default 64, or \"\" if there are none. Stops at any other key,\n"
+"or at a character in the string stop, which is left for keyboard-get-key.";
+const char docInputSteps[] PROGMEM = "(input-steps)\n"
+"Returns the steps the last event from keyboard-get-key adds up to: 1 for a key, and for\n"
+"the trackball the ticks merged into it, with quick ones counting extra unless the screen\n"
+"is touched.";
+const char docTouchHistory[] PROGMEM = "(touch-history)\n"
+"Returns the recent touch frames, oldest first, each as (milliseconds (x . y) ...).";
+const char docPerfCounters[] PROGMEM = "(perf-counters [reset])\n"
+"Returns (keys last p50 p99 max refresh highlight bracket conses gcs pixels display-bytes\n"
+"sd-read sd-written histogram) for the keys handled since the last reset. Times are in\n"
+"microseconds: last, p50, p99 and max per key, over the last 128 keys for the percentiles,\n"
+"and the three native sections as totals. The histogram counts keys by the bit length of\n"
+"their time. If reset is true the counters then restart from zero.";
+const char docPerfLast[] PROGMEM = "(perf-last)\n"
+"Returns the microseconds taken by the last key handled, or nil.";
+const char docLibraryImage[] PROGMEM = "(library-image [save])\n"
+"Used by the Lisp Library. With save true, saves the workspace to the SD card as the\n"
+"library image. Otherwise, if the image there was made from this library and build,\n"
+"loads it, skips the rest of the library source and returns t; if not, returns nil.";
+#if defined(lisplibrary)
+const char docModuleLoad[] PROGMEM = "(module-load name)\n"
+"Evaluates the source of the Lisp Library module name, such as editor, unless it's\n"
+"already loaded. Returns t if it was loaded now, or nil if it already was.";
+const char docModuleUnload[] PROGMEM = "(module-unload name)\n"
+"Removes the global functions and variables defined by the Lisp Library module name,\n"
+"so their space can be reused, and returns how many there were.";
+#endif
+const char docSearchStr[] PROGMEM = "(search pattern target [startpos])\n"
+"Returns the index of the first occurrence of pattern in target, or nil if it's not found\n"
+"starting from startpos";
+const char docSearchStrCi[] PROGMEM = "(search-str-ci pattern target [startpos])\n"
+"Like search-str, but ignores the case of letters.";
+const char docSearchStrBack[] PROGMEM = "(search-str-back pattern target [endpos])\n"
+"Returns the index of the last occurrence of pattern in target that ends at or before endpos,\n"
+"default the end of target, or nil if it's not found.";
+const char docStringSplit[] PROGMEM = "(string-split delim string)\n"
+"Returns a list of the parts of string separated by the string delim.";
+const char docStringJoin[] PROGMEM = "(string-join list [separator])\n"
+"Returns the strings or characters in list joined into one string, with separator between them.";
+const char docStringBuilder[] PROGMEM = "(string-builder)\n"
+"Returns a new, empty string builder.";
+const char docStringBuilderAppend[] PROGMEM = "(string-builder-append builder item*)\n"
+"Appends strings, characters or integers to a string builder, and returns the builder.";
+const char docStringBuilderString[] PROGMEM = "(string-builder-string builder)\n"
+"Returns the contents of a string builder as a string, and frees the builder.";
+const char docBufferClear[] PROGMEM = "(buffer-clear)\n"
+"Removes all lines from the editor buffer.";
+const char docBufferLines[] PROGMEM = "(buffer-lines [upto])\n"
+"Returns the number of lines in the editor buffer. While a file is loading, only reads\n"
+"as far as line upto, and the count is then only sure to be more than upto.";
+const char docBufferMove[] PROGMEM = "(buffer-move x y dx dy)\n"
+"Returns the position (x . y) reached from x in line y by moving dx characters right, or\n"
+"left if negative, going on to the next or previous line at a line end, and then dy lines\n"
+"down or up, keeping x within the line.";
+const char docBufferLine[] PROGMEM = "(buffer-line y [start end])\n"
+"Returns line y of the editor buffer as a string, or nil if there is no such line.\n"
+"With start and end returns that part of the line, padded with spaces past its end.";
+const char docBufferLineLength[] PROGMEM = "(buffer-line-length y)\n"
+"Returns the length of line y, or 0 if there is no such line.";
+const char docBufferChar[] PROGMEM = "(buffer-char x y)\n"
+"Returns the character at x in line y, or nil if x is past the end of the line.";
+const char docBufferInsert[] PROGMEM = "(buffer-insert x y item)\n"
+"Inserts a character or string into line y before position x, and returns the new x.";
+const char docBufferDelete[] PROGMEM = "(buffer-delete x y [n])\n"
+"Deletes n characters, default 1, from line y starting at position x.";
+const char docBufferSplitLine[] PROGMEM = "(buffer-split-line x y)\n"
+"Breaks line y at position x, moving the rest of the line to a new line after it.";
+const char docBufferJoinLines[] PROGMEM = "(buffer-join-lines y)\n"
+"Appends line y+1 to line y, and returns the length line y had before.";
+const char docBufferAddLine[] PROGMEM = "(buffer-add-line [string])\n"
+"Appends a line to the end of the editor buffer.";
+const char docBufferFromList[] PROGMEM = "(buffer-from-list list)\n"
+"Replaces the editor buffer with a list of strings, one per line.";
+const char docBufferToList[] PROGMEM = "(buffer-to-list)\n"
+"Returns the lines in the editor buffer as a list of strings.";
+const char docBufferUndo[] PROGMEM = "(buffer-undo)\n"
+"Undoes the last edit made through the buffer functions, and returns the cursor position\n"
+"(x . y) to go back to, or nil if there is nothing to undo.";
+const char docBufferRedo[] PROGMEM = "(buffer-redo)\n"
+"Redoes the last edit undone, and returns the cursor position (x . y), or nil if there is none.";
+const char docBufferJournalSize[] PROGMEM = "(buffer-journal-size [bytes])\n"
+"Returns the number of bytes kept for the undo history, after setting it to bytes and\n"
+"clearing the history if given.";
+const char docBracketPartner[] PROGMEM = "(bracket-partner x y)\n"
+"Returns the position (x . y) of the bracket matching the one at x in line y, or nil.\n"
+"Brackets inside strings, comments and character literals are ignored.";
+const char docPaletteLoad[] PROGMEM = "(palette-load colours)\n"
+"Replaces the editor palette with a list of 16-bit colours, and marks the editor screen for a redraw.";
+const char docPalette[] PROGMEM = "(palette index)\n"
+"Returns the 16-bit colour at index in the editor palette.";
+const char docgtv[] PROGMEM = "(gtv obj slot)\n"
+"Returns the value of slot in obj, or in its parents if obj doesn't have it.\n"
+"obj is an object made by class, or a symbol bound to one.";
+const char docstv[] PROGMEM = "(stv obj slot value)\n"
+"Sets slot in obj itself to value and returns it, or returns nil if obj has no such slot.";
+const char doccmt[] PROGMEM = "(cmt obj method [arguments]*)\n"
+"Calls the function in slot method of obj or its parents, with obj followed by the\n"
+"arguments, and returns its result.";
+#if defined(gfxsupport)
+const char docScreenSetup[] PROGMEM = "(screen-setup x y cols rows)\n"
+"Sets the position and size in characters of the editor text area, and marks it for a full redraw.";
+const char docScreenInvalidate[] PROGMEM = "(screen-invalidate [top bottom])\n"
+"Marks the text rows between pixel rows top and bottom, default all, for a full redraw.\n"
+"Use after drawing over the text area.";
+const char docScreenRefresh[] PROGMEM = "(screen-refresh ox oy)\n"
+"Brings the editor text area up to date with the buffer scrolled to column ox and line oy.\n"
+"Only characters that differ from what is on the screen are redrawn.";
+const char docScreenHighlight[] PROGMEM = "(screen-highlight on)\n"
+"Turns syntax colouring of the editor text on or off.";
+const char docScreenScroll[] PROGMEM = "(screen-scroll on)\n"
+"Turns hardware scrolling of the editor text area on or off, so that moving the view\n"
+"sideways only redraws the columns that come into view. Returns nil in portrait.";
+const char docScreenOverlay[] PROGMEM = "(screen-overlay)\n"
+"Flushes the display list and puts the hardware scroll back. Call it before drawing over\n"
+"the text area with the graphics functions.";
+const char docScreenRestore[] PROGMEM = "(screen-restore col row [gutter])\n"
+"Redraws the character at column col of text row row as the renderer last drew it, and the\n"
+"row's line number too if gutter is true. Returns nil if the row is due for a full redraw.";
+const char docDrawTextRun[] PROGMEM = "(draw-text-run x y fg bg text [fg bg text]*)\n"
+"Draws each text, a string or character, in colours fg on bg, one after the other from x,y,\n"
+"and sends the whole run to the display at once.";
+const char docDisplayList[] PROGMEM = "(display-list on)\n"
+"Starts recording text drawn with draw-text-run, so that each character cell drawn over\n"
+"is sent once when the list is flushed. If on is nil, flushes the list and stops recording.";
+const char docDisplayFlush[] PROGMEM = "(display-flush)\n"
+"Sends the text recorded in the display list, as one run per row of adjacent cells,\n"
+"and returns the number of runs sent.";
+#endif
+
+#if defined sdcardsupport
+const char docSDFileExists[] PROGMEM = "(sd-file-exists filename)\n"
+"Returns t if filename exists on SD card, otherwise nil.";
+const char docSDFileRemove[] PROGMEM = "(sd-file-remove filename)\n"
 "Delete file with filename. Returns t if successful, otherwise nil.";
 
 const char docDir2[] PROGMEM = "(dir2 [directory])\n"
 "returns a list of filenames in the root or certain directory";
+const char docDirWalk[] PROGMEM = "(dir-walk [directory] [depth] [offset] [limit] [details])\n"
+"Lists directory, default the root, and its subdirectories down to depth levels, depth first.\n"
+"Skips offset entries and returns at most limit, each as (level name size), with size nil\n"
+"for a directory, or as (level name size mtime) if details is true.";
+const char docSDWriteLines[] PROGMEM = "(sd-write-lines filename)\n"
+"Writes the text buffer to filename through a temporary file, replacing it only once\n"
+"the write is complete. Returns (bytes . milliseconds).";
+const char docSDReadLines[] PROGMEM = "(sd-read-lines filename)\n"
+"Replaces the text buffer with the lines of filename. Only the start is read at once;\n"
+"the rest follows as the buffer is used. Returns nil if the file can't be opened.";
 #endif
 
 
@@ -394,14 +3200,69 @@ const char docDir2[] PROGMEM = "(dir2 [directory])\n"
 const tbl_entry_t lookup_table2[] PROGMEM = {
   { string_gettouchpoints, fn_get_touch_points, 0200, doc_gettouchpoints },
 
-  { stringKeyboardGetKey, fn_KeyboardGetKey, 0201, docKeyboardGetKey },
+  { stringKeyboardGetKey, fn_KeyboardGetKey, 0202, docKeyboardGetKey },
   { stringKeyboardFlush, fn_KeyboardFlush, 0200, docKeyboardFlush },
+  { stringInputEvents, fn_InputEvents, 0201, docInputEvents },
+  { stringKeyboardGetText, fn_KeyboardGetText, 0202, docKeyboardGetText },
+  { stringInputSteps, fn_InputSteps, 0200, docInputSteps },
+  { stringTouchHistory, fn_TouchHistory, 0200, docTouchHistory },
+  { stringPerfCounters, fn_PerfCounters, 0201, docPerfCounters },
+  { stringPerfLast, fn_PerfLast, 0200, docPerfLast },
+  { stringLibraryImage, fn_LibraryImage, 0201, docLibraryImage },
+#if defined(lisplibrary)
+  { stringModuleLoad, fn_ModuleLoad, 0211, docModuleLoad },
+  { stringModuleUnload, fn_ModuleUnload, 0211, docModuleUnload },
+#endif
   { stringSearchStr, fn_searchstr, 0224, docSearchStr },
+  { stringSearchStrCi, fn_searchstrci, 0223, docSearchStrCi },
+  { stringSearchStrBack, fn_searchstrback, 0223, docSearchStrBack },
+  { stringStringSplit, fn_StringSplit, 0222, docStringSplit },
+  { stringStringJoin, fn_StringJoin, 0212, docStringJoin },
+  { stringStringBuilder, fn_StringBuilder, 0200, docStringBuilder },
+  { stringStringBuilderAppend, fn_StringBuilderAppend, 0217, docStringBuilderAppend },
+  { stringStringBuilderString, fn_StringBuilderString, 0211, docStringBuilderString },
+  { stringBufferClear, fn_BufferClear, 0200, docBufferClear },
+  { stringBufferLines, fn_BufferLines, 0201, docBufferLines },
+  { stringBufferMove, fn_BufferMove, 0244, docBufferMove },
+  { stringBufferLine, fn_BufferLine, 0213, docBufferLine },
+  { stringBufferLineLength, fn_BufferLineLength, 0211, docBufferLineLength },
+  { stringBufferChar, fn_BufferChar, 0222, docBufferChar },
+  { stringBufferInsert, fn_BufferInsert, 0233, docBufferInsert },
+  { stringBufferDelete, fn_BufferDelete, 0223, docBufferDelete },
+  { stringBufferSplitLine, fn_BufferSplitLine, 0222, docBufferSplitLine },
+  { stringBufferJoinLines, fn_BufferJoinLines, 0211, docBufferJoinLines },
+  { stringBufferAddLine, fn_BufferAddLine, 0201, docBufferAddLine },
+  { stringBufferFromList, fn_BufferFromList, 0211, docBufferFromList },
+  { stringBufferToList, fn_BufferToList, 0200, docBufferToList },
+  { stringBufferUndo, fn_BufferUndo, 0200, docBufferUndo },
+  { stringBufferRedo, fn_BufferRedo, 0200, docBufferRedo },
+  { stringBufferJournalSize, fn_BufferJournalSize, 0201, docBufferJournalSize },
+  { stringBracketPartner, fn_BracketPartner, 0222, docBracketPartner },
+  { stringPaletteLoad, fn_PaletteLoad, 0211, docPaletteLoad },
+  { stringPalette, fn_Palette, 0211, docPalette },
+  { stringgtv, fn_gtv, 0222, docgtv },
+  { stringstv, fn_stv, 0233, docstv },
+  { stringcmt, fn_cmt, 0227, doccmt },
+#if defined(gfxsupport)
+  { stringScreenSetup, fn_ScreenSetup, 0244, docScreenSetup },
+  { stringScreenInvalidate, fn_ScreenInvalidate, 0202, docScreenInvalidate },
+  { stringScreenRefresh, fn_ScreenRefresh, 0222, docScreenRefresh },
+  { stringScreenHighlight, fn_ScreenHighlight, 0211, docScreenHighlight },
+  { stringScreenScroll, fn_ScreenScroll, 0211, docScreenScroll },
+  { stringScreenOverlay, fn_ScreenOverlay, 0200, docScreenOverlay },
+  { stringScreenRestore, fn_ScreenRestore, 0223, docScreenRestore },
+  { stringDrawTextRun, fn_DrawTextRun, 0257, docDrawTextRun },
+  { stringDisplayList, fn_DisplayList, 0211, docDisplayList },
+  { stringDisplayFlush, fn_DisplayFlush, 0200, docDisplayFlush },
+#endif
 #if defined sdcardsupport
   { stringSDFileExists, fn_SDFileExists, 0211, docSDFileExists },
   { stringSDFileRemove, fn_SDFileRemove, 0211, docSDFileRemove },
 
   { stringDir2, fn_directory2, 0201, docDir2 },
+  { stringDirWalk, fn_DirWalk, 0205, docDirWalk },
+  { stringSDWriteLines, fn_SDWriteLines, 0211, docSDWriteLines },
+  { stringSDReadLines, fn_SDReadLines, 0211, docSDReadLines },
 #endif
 
 };
@@ -0,0 +1,156 @@
+/*
+  Host simulator - stand-in for the Adafruit GFX library
+
+  The drawing primitives reduce to writePixel and writeFillRect, which the
+  display implements and counts. Characters are drawn pixel by pixel as the
+  library's classic font is, so the traffic matches, but the glyphs are plain
+  boxes; the display also records which character was drawn where, and that
+  text layer is what sedit-sim -t dumps.
+*/
+
+#ifndef ADAFRUIT_GFX_H
+#define ADAFRUIT_GFX_H
+
+#include "Arduino.h"
+
+class Adafruit_GFX : public Print {
+  public:
+  Adafruit_GFX (int16_t w, int16_t h) : WIDTH(w), HEIGHT(h), _width(w), _height(h) { }
+
+  virtual void drawPixel (int16_t x, int16_t y, uint16_t color) = 0;
+  virtual void startWrite () { }
+  virtual void endWrite () { }
+  virtual void writePixel (int16_t x, int16_t y, uint16_t color) { drawPixel(x, y, color); }
+  virtual void writeFillRect (int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+    for (int16_t i = x; i < x + w; i++) writeFastVLine(i, y, h, color);
+  }
+  virtual void writeFastVLine (int16_t x, int16_t y, int16_t h, uint16_t color) { writeFillRect(x, y, 1, h, color); }
+  virtual void writeFastHLine (int16_t x, int16_t y, int16_t w, uint16_t color) { writeFillRect(x, y, w, 1, color); }
+  virtual void chardrawn (int16_t x, int16_t y, unsigned char c) { (void) x, (void) y, (void) c; }
+
+  void writeLine (int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) {
+    int16_t dx = abs(x1 - x0), dy = -abs(y1 - y0), sx = x0 < x1 ? 1 : -1, sy = y0 < y1 ? 1 : -1, err = dx + dy;
+    for (;;) {
+      writePixel(x0, y0, color);
+      if (x0 == x1 && y0 == y1) break;
+      int16_t e2 = 2*err;
+      if (e2 >= dy) { err += dy; x0 += sx; }
+      if (e2 <= dx) { err += dx; y0 += sy; }
+    }
+  }
+
+  void fillRect (int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) { startWrite(); writeFillRect(x, y, w, h, color); endWrite(); }
+  void fillScreen (uint16_t color) { fillRect(0, 0, _width, _height, color); }
+  void drawFastVLine (int16_t x, int16_t y, int16_t h, uint16_t color) { startWrite(); writeFastVLine(x, y, h, color); endWrite(); }
+  void drawFastHLine (int16_t x, int16_t y, int16_t w, uint16_t color) { startWrite(); writeFastHLine(x, y, w, color); endWrite(); }
+  void drawLine (int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) {
+    startWrite();
+    if (x0 == x1) writeFastVLine(x0, min(y0, y1), abs(y1 - y0) + 1, color);
+    else if (y0 == y1) writeFastHLine(min(x0, x1), y0, abs(x1 - x0) + 1, color);
+    else writeLine(x0, y0, x1, y1, color);
+    endWrite();
+  }
+  void drawRect (int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+    startWrite();
+    writeFastHLine(x, y, w, color); writeFastHLine(x, y + h - 1, w, color);
+    writeFastVLine(x, y, h, color); writeFastVLine(x + w - 1, y, h, color);
+    endWrite();
+  }
+  // Rounded corners are not simulated
+  void drawRoundRect (int16_t x, int16_t y, int16_t w, int16_t h, int16_t r, uint16_t color) { (void) r; drawRect(x, y, w, h, color); }
+  void fillRoundRect (int16_t x, int16_t y, int16_t w, int16_t h, int16_t r, uint16_t color) { (void) r; fillRect(x, y, w, h, color); }
+  void drawCircle (int16_t x0, int16_t y0, int16_t r, uint16_t color) {
+    startWrite();
+    for (int16_t x = 0, y = r, f = 1 - r; x <= y; x++) {
+      writePixel(x0 + x, y0 + y, color); writePixel(x0 - x, y0 + y, color);
+      writePixel(x0 + x, y0 - y, color); writePixel(x0 - x, y0 - y, color);
+      writePixel(x0 + y, y0 + x, color); writePixel(x0 - y, y0 + x, color);
+      writePixel(x0 + y, y0 - x, color); writePixel(x0 - y, y0 - x, color);
+      if (f >= 0) { y--; f += 2*(x - y) + 5; } else f += 2*x + 3;
+    }
+    endWrite();
+  }
+  void fillCircle (int16_t x0, int16_t y0, int16_t r, uint16_t color) {
+    startWrite();
+    for (int16_t y = -r; y <= r; y++) {
+      int16_t w = (int16_t)sqrt((double)(r*r - y*y));
+      writeFastHLine(x0 - w, y0 + y, 2*w + 1, color);
+    }
+    endWrite();
+  }
+  void drawTriangle (int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint16_t color) {
+    drawLine(x0, y0, x1, y1, color); drawLine(x1, y1, x2, y2, color); drawLine(x2, y2, x0, y0, color);
+  }
+  void fillTriangle (int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint16_t color) {
+    startWrite();
+    for (int16_t y = min(y0, min(y1, y2)); y <= max(y0, max(y1, y2)); y++) {
+      int16_t lo = INT16_MAX, hi = INT16_MIN;
+      int16_t xs[3] = { x0, x1, x2 }, ys[3] = { y0, y1, y2 };
+      for (int e = 0; e < 3; e++) {
+        int16_t ax = xs[e], ay = ys[e], bx = xs[(e + 1) % 3], by = ys[(e + 1) % 3];
+        if ((y < min(ay, by)) || (y > max(ay, by))) continue;
+        int16_t x = (ay == by) ? min(ax, bx) : ax + (int32_t)(bx - ax)*(y - ay)/(by - ay);
+        lo = min(lo, x); hi = max(hi, (ay == by) ? max(ax, bx) : x);
+      }
+      if (lo <= hi) writeFastHLine(lo, y, hi - lo + 1, color);
+    }
+    endWrite();
+  }
+
+  void drawChar (int16_t x, int16_t y, unsigned char c, uint16_t color, uint16_t bg, uint8_t size) {
+    startWrite();
+    for (int8_t i = 0; i < 5; i++) {
+      for (int8_t j = 0; j < 8; j++) {
+        bool ink = (c > ' ') && j < 7 && (i == 0 || i == 4 || j == 0 || j == 6);
+        if (ink || bg != color) {
+          if (size == 1) writePixel(x + i, y + j, ink ? color : bg);
+          else writeFillRect(x + i*size, y + j*size, size, size, ink ? color : bg);
+        }
+      }
+    }
+    if (bg != color) {
+      if (size == 1) writeFastVLine(x + 5, y, 8, bg);
+      else writeFillRect(x + 5*size, y, size, 8*size, bg);
+    }
+    endWrite();
+    chardrawn(x, y, c);
+  }
+
+  size_t write (uint8_t c) {
+    if (c == '\n') { cursor_x = 0; cursor_y += textsize*8; }
+    else if (c != '\r') {
+      if (wrap && cursor_x + textsize*6 > _width) { cursor_x = 0; cursor_y += textsize*8; }
+      drawChar(cursor_x, cursor_y, c, textcolor, textbgcolor, textsize);
+      cursor_x += textsize*6;
+    }
+    return 1;
+  }
+  using Print::write;
+
+  void setCursor (int16_t x, int16_t y) { cursor_x = x; cursor_y = y; }
+  int16_t getCursorX () const { return cursor_x; }
+  int16_t getCursorY () const { return cursor_y; }
+  void setTextColor (uint16_t c) { textcolor = textbgcolor = c; }
+  void setTextColor (uint16_t c, uint16_t bg) { textcolor = c; textbgcolor = bg; }
+  void setTextSize (uint8_t s) { textsize = (s > 0) ? s : 1; }
+  void setTextWrap (bool w) { wrap = w; }
+  void cp437 (bool) { }
+  virtual void setRotation (uint8_t r) {
+    rotation = r & 3;
+    _width = (rotation & 1) ? HEIGHT : WIDTH;
+    _height = (rotation & 1) ? WIDTH : HEIGHT;
+  }
+  uint8_t getRotation () const { return rotation; }
+  int16_t width () const { return _width; }
+  int16_t height () const { return _height; }
+  virtual void invertDisplay (bool) { }
+
+  protected:
+  int16_t WIDTH, HEIGHT, _width, _height;
+  int16_t cursor_x = 0, cursor_y = 0;
+  uint16_t textcolor = 0xFFFF, textbgcolor = 0xFFFF;
+  uint8_t textsize = 1, rotation = 0;
+  bool wrap = true;
+};
+
+#endif
@@ -0,0 +1,190 @@
+/*
+  Host simulator - stand-in for the ST7789 display driver
+
+  Pixels land in a framebuffer that sedit-sim -o writes out as a PPM. SPI
+  traffic is modelled on the real driver: an address window costs 11 bytes
+  (CASET, RASET and RAMWR with their arguments), a lone pixel therefore costs
+  13, and a run of pixels costs 2 bytes each after its window.
+
+  A window one character cell high and a whole number of cells wide, filled
+  in one go, is taken to be a run of text in the glcdfont.c stand-in, and its
+  characters are read back into the text layer.
+
+  Vertical scrolling (VSCRDEF and VSCSAD) is applied when the glass is
+  written out: the scroll area moves along the panel's 320-pixel axis, which
+  is x in the landscape rotations and y in portrait. The scroll registers count
+  frame memory rows, which rotations 0 and 1 (MADCTL MY) lay out in reverse of
+  that coordinate.
+*/
+
+#ifndef ADAFRUIT_ST7789_H
+#define ADAFRUIT_ST7789_H
+
+#include "Adafruit_GFX.h"
+#include "SPI.h"
+
+#define ST77XX_NOP     0x00
+#define ST77XX_SWRESET 0x01
+#define ST77XX_SLPOUT  0x11
+#define ST77XX_NORON   0x13
+#define ST77XX_INVOFF  0x20
+#define ST77XX_INVON   0x21
+#define ST77XX_DISPOFF 0x28
+#define ST77XX_DISPON  0x29
+#define ST77XX_CASET   0x2A
+#define ST77XX_RASET   0x2B
+#define ST77XX_RAMWR   0x2C
+#define ST77XX_VSCRDEF 0x33
+#define ST77XX_MADCTL  0x36
+#define ST77XX_VSCSAD  0x37
+#define ST77XX_COLMOD  0x3A
+
+#define ST77XX_BLACK   0x0000
+#define ST77XX_WHITE   0xFFFF
+#define ST77XX_RED     0xF800
+#define ST77XX_GREEN   0x07E0
+#define ST77XX_BLUE    0x001F
+#define ST77XX_CYAN    0x07FF
+#define ST77XX_MAGENTA 0xF81F
+#define ST77XX_YELLOW  0xFFE0
+#define ST77XX_ORANGE  0xFC00
+
+#define SIM_TFT_SIZE (240*320)
+
+class Adafruit_ST7789 : public Adafruit_GFX {
+  public:
+  Adafruit_ST7789 (int8_t cs, int8_t dc, int8_t mosi, int8_t sclk, int8_t rst = -1) : Adafruit_GFX(240, 320) { (void) cs, (void) dc, (void) mosi, (void) sclk, (void) rst; }
+  Adafruit_ST7789 (int8_t cs, int8_t dc, int8_t rst) : Adafruit_GFX(240, 320) { (void) cs, (void) dc, (void) rst; }
+  Adafruit_ST7789 (SPIClass *spi, int8_t cs, int8_t dc, int8_t rst) : Adafruit_GFX(240, 320) { (void) spi, (void) cs, (void) dc, (void) rst; }
+
+  void init (uint16_t width = 240, uint16_t height = 320, uint8_t mode = SPI_MODE0) {
+    (void) mode;
+    WIDTH = _width = width; HEIGHT = _height = height;
+    setRotation(0);
+  }
+  void setSPISpeed (uint32_t) { }
+  void setRotation (uint8_t r) {
+    Adafruit_GFX::setRotation(r);
+    sendCommand(ST77XX_MADCTL, &rotation, 1);
+  }
+  void invertDisplay (bool i) { sendCommand(i ? ST77XX_INVON : ST77XX_INVOFF, NULL, 0); }
+  void enableDisplay (bool on) { sendCommand(on ? ST77XX_DISPON : ST77XX_DISPOFF, NULL, 0); }
+
+  void sendCommand (uint8_t command, const uint8_t *data = NULL, uint8_t n = 0) {
+    if (command == ST77XX_VSCRDEF && n == 6) {
+      Tfa = data[0]<<8 | data[1]; Vsa = data[2]<<8 | data[3];
+    } else if (command == ST77XX_VSCSAD && n == 2) {
+      Ssa = data[0]<<8 | data[1];
+      Sim.scrolls++;
+    }
+    Sim.spibytes += 1 + n;
+  }
+  void setAddrWindow (uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
+    WinX = x; WinY = y; WinW = w; WinH = h; WinN = 0;
+    Sim.spibytes += 11;
+  }
+  void writePixels (uint16_t *colors, uint32_t len, bool block = true, bool bigEndian = false) {
+    (void) block;
+    for (uint32_t i = 0; i < len; i++) {
+      uint16_t c = bigEndian ? (uint16_t)((colors[i]>>8) | (colors[i]<<8)) : colors[i];
+      if (WinW > 0) {
+        put(WinX + WinN % WinW, WinY + WinN / WinW, c);
+        WinN++;
+      }
+    }
+    Sim.spibytes += 2*len;
+    Sim.pixels += len;
+    if (WinH == 10 && WinW % 6 == 0 && WinN == (uint32_t)WinW*WinH) readrun();
+  }
+  void writeColor (uint16_t color, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) writePixels(&color, 1);
+  }
+  void dmaWait () { }
+
+  void drawPixel (int16_t x, int16_t y, uint16_t color) { writePixel(x, y, color); }
+  void writePixel (int16_t x, int16_t y, uint16_t color) {
+    if (x < 0 || y < 0 || x >= _width || y >= _height) return;
+    setAddrWindow(x, y, 1, 1);
+    writePixels(&color, 1);
+  }
+  void writeFillRect (int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    w = min<int16_t>(w, _width - x); h = min<int16_t>(h, _height - y);
+    if (w <= 0 || h <= 0) return;
+    setAddrWindow(x, y, w, h);
+    for (int16_t j = y; j < y + h; j++) {
+      for (int16_t i = x; i < x + w; i++) { put(i, j, color); Text[j*_width + i] = 0; }
+    }
+    Sim.spibytes += 2*(uint32_t)w*h;
+    Sim.pixels += (uint32_t)w*h;
+  }
+  void writeFastVLine (int16_t x, int16_t y, int16_t h, uint16_t color) { writeFillRect(x, y, 1, h, color); }
+  void writeFastHLine (int16_t x, int16_t y, int16_t w, uint16_t color) { writeFillRect(x, y, w, 1, color); }
+  void chardrawn (int16_t x, int16_t y, unsigned char c) {
+    if (x >= 0 && y >= 0 && x < _width && y < _height) Text[y*_width + x] = c;
+  }
+
+  uint16_t color565 (uint8_t r, uint8_t g, uint8_t b) { return ((r & 0xF8)<<8) | ((g & 0xFC)<<3) | (b>>3); }
+
+  // Simulator only: what is on the glass
+  uint16_t pixelat (int16_t x, int16_t y) const { return Frame[glass(x, y)]; }
+  void writeppm (FILE *out) const {
+    fprintf(out, "P6\n%d %d\n255\n", _width, _height);
+    for (int i = 0; i < _width*_height; i++) {
+      uint16_t c = Frame[glass(i % _width, i / _width)];
+      fputc((c>>8 & 0xF8) | (c>>13), out); fputc((c>>3 & 0xFC) | (c>>9 & 3), out); fputc((c<<3 & 0xF8) | (c>>2 & 7), out);
+    }
+  }
+  // One line of text per row of character cells that has any characters on it
+  void writetext (FILE *out) const {
+    for (int y = 0; y < _height; y++) {
+      std::string line;
+      for (int x = 0; x < _width; x++) {
+        unsigned char c = Text[glass(x, y)];
+        if (c == 0) continue;
+        size_t col = x/6;
+        if (line.size() <= col) line.resize(col + 1, ' ');
+        line[col] = (c < ' ' || c > '~') ? '?' : c;
+      }
+      if (!line.empty()) fprintf(out, "%3d: %s\n", y, line.c_str());
+    }
+  }
+
+  private:
+  // Where in the frame memory the pixel seen at x,y is, given the scroll
+  int glass (int x, int y) const {
+    int &line = (rotation & 1) ? x : y;
+    int last = ((rotation & 1) ? _width : _height) - 1;
+    int row = (rotation < 2) ? last - line : line;
+    if (Vsa > 0 && row >= Tfa && row < Tfa + Vsa && Ssa >= Tfa) row = Tfa + (row - Tfa + Ssa - Tfa) % Vsa;
+    line = (rotation < 2) ? last - row : row;
+    return y*_width + x;
+  }
+  void readrun () {
+    for (int x = WinX; x + 6 <= WinX + WinW; x = x + 6) {
+      if (x >= _width || WinY >= _height) return;
+      uint16_t bg = Frame[WinY*_width + x + 5];
+      unsigned char c = ' ';
+      if (Frame[WinY*_width + x] != bg) {
+        c = 0;
+        for (int col = 1; col < 4; col++) {
+          for (int row = 1; row < 4; row++) {
+            if (Frame[(WinY + row)*_width + x + col] != bg) c |= 1<<(3*(col - 1) + row - 1);
+          }
+        }
+      }
+      chardrawn(x, WinY, c);
+    }
+  }
+  void put (int x, int y, uint16_t color) {
+    if (x >= 0 && y >= 0 && x < _width && y < _height) Frame[y*_width + x] = color;
+  }
+  uint16_t Frame[SIM_TFT_SIZE] = { 0 };
+  unsigned char Text[SIM_TFT_SIZE] = { 0 };
+  uint16_t WinX = 0, WinY = 0, WinW = 0, WinH = 0;
+  uint32_t WinN = 0;
+  int Tfa = 0, Vsa = 0, Ssa = 0;
+};
+
+#endif
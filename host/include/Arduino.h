@@ -0,0 +1,165 @@
+/*
+  Host simulator - stand-in for the ESP32 Arduino core
+
+  Only what uLisp and extensions.ino use. Time is the host's monotonic clock,
+  pins read as idle, and Serial is stdin/stdout.
+*/
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <limits.h>
+#include <time.h>
+#include <setjmp.h>
+#include <algorithm>
+#include <string>
+#include "sim.h"
+
+using std::min;
+using std::max;
+using std::abs;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define ARDUINO 10819
+#define PROGMEM
+#define IRAM_ATTR
+#define PSTR(s) (s)
+#define F(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define pgm_read_ptr(p) (*(void * const *)(p))
+#define pgm_read_float(p) (*(const float *)(p))
+#define strcpy_P strcpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define snprintf_P snprintf
+
+#define LOW            0
+#define HIGH           1
+#define INPUT          0x01
+#define OUTPUT         0x03
+#define PULLUP         0x04
+#define INPUT_PULLUP   0x05
+#define PULLDOWN       0x08
+#define INPUT_PULLDOWN 0x09
+#define RISING         0x01
+#define FALLING        0x02
+#define CHANGE         0x03
+#define ONLOW          0x04
+#define ONHIGH         0x05
+#define digitalPinToInterrupt(p) (p)
+#define LED_BUILTIN    -1
+
+class __FlashStringHelper;
+
+unsigned long millis ();
+unsigned long micros ();
+void delay (unsigned long ms);
+void delayMicroseconds (unsigned int us);
+void yield ();
+
+inline void pinMode (int, int) { }
+inline int digitalRead (int) { return HIGH; }
+inline void digitalWrite (int, int) { }
+inline int analogRead (int) { return 0; }
+inline void analogWrite (int, int) { }
+inline void analogReadResolution (int) { }
+inline void analogWriteResolution (int) { }
+inline void dacWrite (int, int) { }
+inline void noInterrupts () { }
+inline void interrupts () { }
+inline void attachInterrupt (int pin, void (*isr)(), int mode) { simattach(pin, isr, mode); }
+inline void detachInterrupt (int pin) { simattach(pin, NULL, 0); }
+inline long random (long howbig) { return howbig > 0 ? rand() % howbig : 0; }
+inline long random (long howsmall, long howbig) { return howsmall + random(howbig - howsmall); }
+inline void randomSeed (unsigned long seed) { srand(seed); }
+inline uint32_t esp_random () { return (uint32_t)rand(); }
+inline void *ps_malloc (size_t size) { return malloc(size); }
+inline bool psramFound () { return false; }
+inline void tone (int, unsigned int, unsigned long = 0) { }
+inline void noTone (int) { }
+
+class EspClass {
+  public:
+  uint32_t getFreeHeap () { return 200000; }
+  uint32_t getPsramSize () { return 0; }
+  void restart () { exit(0); }
+};
+extern EspClass ESP;
+
+class String : public std::string {
+  public:
+  String () { }
+  String (const char *s) : std::string(s ? s : "") { }
+  String (const std::string &s) : std::string(s) { }
+  String (int n) : std::string(std::to_string(n)) { }
+  unsigned int length () const { return size(); }
+  int indexOf (char c) const { size_t i = find(c); return i == npos ? -1 : (int)i; }
+  String substring (unsigned int from, unsigned int to = UINT_MAX) const { return String(substr(from, to == UINT_MAX ? npos : to - from)); }
+  void toCharArray (char *buf, unsigned int n) const { strncpy(buf, c_str(), n); if (n) buf[n-1] = 0; }
+};
+
+class Print {
+  public:
+  virtual ~Print () { }
+  virtual size_t write (uint8_t c) = 0;
+  virtual size_t write (const uint8_t *buf, size_t n) { size_t i = 0; while (i < n && write(buf[i])) i++; return i; }
+  size_t write (const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t print (const char *s) { return write(s); }
+  size_t print (const String &s) { return write(s.c_str()); }
+  size_t print (char c) { return write((uint8_t)c); }
+  size_t print (int n, int base = 10) { return print((long)n, base); }
+  size_t print (unsigned int n, int base = 10) { return print((unsigned long)n, base); }
+  size_t print (long n, int base = 10) {
+    if (base == 10) { char buf[24]; snprintf(buf, sizeof(buf), "%ld", n); return write(buf); }
+    return print((unsigned long)n, base);
+  }
+  size_t print (unsigned long n, int base = 10) {
+    char buf[68], *p = &buf[67];
+    *p = 0;
+    do { int d = n % base; *--p = d < 10 ? '0' + d : 'A' + d - 10; n = n / base; } while (n);
+    return write(p);
+  }
+  size_t print (double f, int digits = 2) { char buf[32]; snprintf(buf, sizeof(buf), "%.*f", digits, f); return write(buf); }
+  size_t println () { return write("\r\n"); }
+  template <typename T> size_t println (T x) { size_t n = print(x); return n + println(); }
+  template <typename T> size_t println (T x, int opt) { size_t n = print(x, opt); return n + println(); }
+  size_t printf (const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+  virtual void flush () { }
+};
+
+class Stream : public Print {
+  public:
+  virtual int available () = 0;
+  virtual int read () = 0;
+  virtual int peek () { return -1; }
+  void setTimeout (unsigned long) { }
+};
+
+class HardwareSerial : public Stream {
+  public:
+  void begin (unsigned long, ...) { }
+  void end () { }
+  int available ();
+  int read ();
+  int peek ();
+  size_t write (uint8_t c) { fputc(c, stdout); return 1; }
+  size_t write (const uint8_t *buf, size_t n) { return fwrite(buf, 1, n, stdout); }
+  using Print::write;
+  void flush () { fflush(stdout); }
+  operator bool () const { return true; }
+};
+extern HardwareSerial Serial, Serial1, Serial2;
+
+#endif
@@ -0,0 +1,5 @@
+/*
+  Host simulator - File lives with the SD stand-in
+*/
+
+#include "SD.h"
@@ -0,0 +1,157 @@
+/*
+  Host simulator - stand-in for the ESP32 SD library
+
+  The card is a directory on the host, given with sedit-sim -s. Paths on the
+  card are absolute, as with the real library, and are mapped under that
+  directory. Bytes read and written are counted.
+*/
+
+#ifndef SD_H
+#define SD_H
+
+#include "Arduino.h"
+#include "SPI.h"
+#include <memory>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FILE_READ   "r"
+#define FILE_WRITE  "w"
+#define FILE_APPEND "a"
+
+typedef enum { CARD_NONE, CARD_MMC, CARD_SD, CARD_SDHC, CARD_UNKNOWN } sdcard_type_t;
+
+inline std::string simhostpath (const char *path) {
+  std::string host = simsdroot();
+  if (path[0] != '/') host += '/';
+  return host + path;
+}
+
+class File : public Stream {
+  public:
+  File () { }
+  File (const char *path, const char *mode) {
+    std::string host = simhostpath(path);
+    struct stat st;
+    bool exists = (stat(host.c_str(), &st) == 0);
+    if (exists && S_ISDIR(st.st_mode)) {
+      DIR *dir = opendir(host.c_str());
+      if (dir == NULL) return;
+      Impl = std::make_shared<impl>();
+      Impl->dir = dir;
+    } else {
+      if (!exists && mode[0] == 'r') return;
+      FILE *fp = fopen(host.c_str(), mode[0] == 'a' ? "a+b" : mode[0] == 'w' ? "w+b" : "rb");
+      if (fp == NULL) return;
+      Impl = std::make_shared<impl>();
+      Impl->fp = fp;
+    }
+    Sim.sdopens++;
+    Impl->path = path;
+    size_t slash = Impl->path.find_last_of('/');
+    Impl->name = (slash == std::string::npos) ? Impl->path : Impl->path.substr(slash + 1);
+  }
+
+  operator bool () const { return Impl != NULL && (Impl->fp != NULL || Impl->dir != NULL); }
+  const char *name () const { return Impl ? Impl->name.c_str() : ""; }
+  const char *path () const { return Impl ? Impl->path.c_str() : ""; }
+  bool isDirectory () const { return Impl != NULL && Impl->dir != NULL; }
+
+  size_t write (uint8_t c) { return write(&c, 1); }
+  size_t write (const uint8_t *buf, size_t n) {
+    if (!Impl || Impl->fp == NULL) return 0;
+    n = fwrite(buf, 1, n, Impl->fp);
+    Sim.sdwritten += n;
+    return n;
+  }
+  using Print::write;
+  int read () {
+    uint8_t c;
+    return (read(&c, 1) == 1) ? c : -1;
+  }
+  int read (uint8_t *buf, size_t n) {
+    if (!Impl || Impl->fp == NULL) return -1;
+    n = fread(buf, 1, n, Impl->fp);
+    Sim.sdread += n;
+    return n;
+  }
+  int peek () {
+    if (!Impl || Impl->fp == NULL) return -1;
+    int c = fgetc(Impl->fp);
+    if (c != EOF) ungetc(c, Impl->fp);
+    return c;
+  }
+  int available () {
+    if (!Impl || Impl->fp == NULL) return 0;
+    return size() - position();
+  }
+  void flush () { if (Impl && Impl->fp) fflush(Impl->fp); }
+  bool seek (uint32_t pos) { return Impl && Impl->fp && fseek(Impl->fp, pos, SEEK_SET) == 0; }
+  size_t position () const { return (Impl && Impl->fp) ? ftell(Impl->fp) : 0; }
+  size_t size () const {
+    struct stat st;
+    if (!Impl) return 0;
+    if (Impl->fp) fflush(Impl->fp);
+    return (stat(simhostpath(Impl->path.c_str()).c_str(), &st) == 0) ? st.st_size : 0;
+  }
+  time_t getLastWrite () {
+    struct stat st;
+    return (Impl && stat(simhostpath(Impl->path.c_str()).c_str(), &st) == 0) ? st.st_mtime : 0;
+  }
+  void close () { Impl.reset(); }
+
+  File openNextFile (const char *mode = FILE_READ) {
+    if (!isDirectory()) return File();
+    struct dirent *entry;
+    while ((entry = readdir(Impl->dir)) != NULL) {
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+      std::string child = Impl->path;
+      if (child.empty() || child[child.size() - 1] != '/') child += '/';
+      return File((child + entry->d_name).c_str(), mode);
+    }
+    return File();
+  }
+  void rewindDirectory () { if (isDirectory()) rewinddir(Impl->dir); }
+
+  private:
+  struct impl {
+    FILE *fp = NULL;
+    DIR *dir = NULL;
+    std::string path, name;
+    ~impl () { if (fp) fclose(fp); if (dir) closedir(dir); }
+  };
+  std::shared_ptr<impl> Impl;
+};
+
+class SDFS {
+  public:
+  bool begin (uint8_t ssPin = 0, SPIClass &spi = SPI, uint32_t frequency = 4000000, const char *mountpoint = "/sd",
+    uint8_t maxfiles = 5, bool format = false) {
+    (void) ssPin, (void) spi, (void) frequency, (void) mountpoint, (void) maxfiles, (void) format;
+    Mounted = true;
+    return true;
+  }
+  void end () { Mounted = false; }
+  sdcard_type_t cardType () { return Mounted ? CARD_SDHC : CARD_NONE; }
+  uint64_t cardSize () { return 1ULL<<32; }
+  uint64_t totalBytes () { return 1ULL<<32; }
+  uint64_t usedBytes () { return 0; }
+  File open (const char *path, const char *mode = FILE_READ, bool create = false) { (void) create; return File(path, mode); }
+  File open (const String &path, const char *mode = FILE_READ) { return File(path.c_str(), mode); }
+  bool exists (const char *path) { struct stat st; return stat(simhostpath(path).c_str(), &st) == 0; }
+  bool remove (const char *path) { return unlink(simhostpath(path).c_str()) == 0; }
+  bool rename (const char *from, const char *to) {
+    if (exists(to)) return false; // as on FAT
+    return ::rename(simhostpath(from).c_str(), simhostpath(to).c_str()) == 0;
+  }
+  bool mkdir (const char *path) { return ::mkdir(simhostpath(path).c_str(), 0777) == 0; }
+  bool rmdir (const char *path) { return ::rmdir(simhostpath(path).c_str()) == 0; }
+
+  private:
+  bool Mounted = false;
+};
+
+extern SDFS SD;
+
+#endif
@@ -0,0 +1,28 @@
+/*
+  Host simulator - stand-in for the SPI bus; the display counts its own traffic
+*/
+
+#ifndef SPI_H
+#define SPI_H
+
+#include "Arduino.h"
+
+#define SPI_MODE0 0
+
+class SPISettings {
+  public:
+  SPISettings (uint32_t = 0, uint8_t = 0, uint8_t = 0) { }
+};
+
+class SPIClass {
+  public:
+  void begin (int8_t = -1, int8_t = -1, int8_t = -1, int8_t = -1) { }
+  void end () { }
+  void beginTransaction (SPISettings) { }
+  void endTransaction () { }
+  uint8_t transfer (uint8_t) { Sim.spibytes++; return 0; }
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,35 @@
+/*
+  Host simulator - stand-in for the GT911 touch controller driver
+
+  Reports the scripted touch points. Each read counts as an I2C transaction; the
+  INT line is pulsed by the script while a finger is down.
+*/
+
+#ifndef TOUCHDRVGT911_HPP
+#define TOUCHDRVGT911_HPP
+
+#include "Arduino.h"
+#include "Wire.h"
+
+#define GT911_SLAVE_ADDRESS_H 0x14
+#define GT911_SLAVE_ADDRESS_L 0x5D
+
+class TouchDrvGT911 {
+  public:
+  void setPins (int rst, int irq) { (void) rst, (void) irq; }
+  bool begin (TwoWire &wire, uint8_t address, int sda = -1, int scl = -1) { (void) wire, (void) address, (void) sda, (void) scl; return true; }
+  void setMaxCoordinates (uint16_t x, uint16_t y) { (void) x, (void) y; }
+  void setSwapXY (bool swap) { (void) swap; }
+  void setMirrorXY (bool x, bool y) { (void) x, (void) y; }
+  uint8_t getSupportTouchPoint () { return 5; }
+  uint8_t getPoint (int16_t *x, int16_t *y, uint8_t size = 1) {
+    Sim.i2c++;
+    return simtouch(x, y, size);
+  }
+  bool isPressed () {
+    int16_t x[5], y[5];
+    return simtouch(x, y, 5) > 0;
+  }
+};
+
+#endif
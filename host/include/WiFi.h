@@ -0,0 +1,61 @@
+/*
+  Host simulator - stand-in for WiFi; there is no network, so nothing ever connects
+*/
+
+#ifndef WIFI_H
+#define WIFI_H
+
+#include "Arduino.h"
+
+#define WL_CONNECTED    3
+#define WL_DISCONNECTED 6
+#define WIFI_STA        1
+#define WIFI_AP         2
+
+class IPAddress {
+  public:
+  IPAddress (uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) { Bytes[0] = a; Bytes[1] = b; Bytes[2] = c; Bytes[3] = d; }
+  uint8_t operator[] (int i) const { return Bytes[i]; }
+  String toString () const { char buf[16]; snprintf(buf, sizeof(buf), "%d.%d.%d.%d", Bytes[0], Bytes[1], Bytes[2], Bytes[3]); return String(buf); }
+
+  private:
+  uint8_t Bytes[4];
+};
+
+class WiFiClient : public Stream {
+  public:
+  int connect (const char *, uint16_t) { return 0; }
+  int connect (IPAddress, uint16_t) { return 0; }
+  uint8_t connected () { return 0; }
+  int available () { return 0; }
+  int read () { return -1; }
+  size_t write (uint8_t) { return 0; }
+  using Print::write;
+  void stop () { }
+  operator bool () { return false; }
+};
+
+class WiFiServer {
+  public:
+  WiFiServer (uint16_t port = 80) { (void) port; }
+  void begin () { }
+  WiFiClient available () { return WiFiClient(); }
+  void setNoDelay (bool) { }
+};
+
+class WiFiClass {
+  public:
+  int begin (const char *, const char * = NULL) { return WL_DISCONNECTED; }
+  int status () { return WL_DISCONNECTED; }
+  bool mode (int) { return true; }
+  void disconnect (bool = false) { }
+  IPAddress localIP () { return IPAddress(); }
+  IPAddress softAPIP () { return IPAddress(); }
+  bool softAP (const char *, const char * = NULL) { return false; }
+  bool softAPConfig (IPAddress, IPAddress, IPAddress) { return false; }
+  bool config (IPAddress, IPAddress, IPAddress) { return false; }
+};
+
+extern WiFiClass WiFi;
+
+#endif
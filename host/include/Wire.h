@@ -0,0 +1,45 @@
+/*
+  Host simulator - stand-in for the I2C bus
+
+  Reads from the T-Deck keyboard at 0x55 return the next scripted key, one byte
+  per request as the keyboard firmware does. Each request counts as a transaction.
+*/
+
+#ifndef WIRE_H
+#define WIRE_H
+
+#include "Arduino.h"
+
+#define KEYBOARD_ADDRESS 0x55
+
+class TwoWire : public Stream {
+  public:
+  bool begin (int sda = -1, int scl = -1, uint32_t frequency = 0) { (void) sda, (void) scl, (void) frequency; return true; }
+  void setClock (uint32_t) { }
+  void beginTransmission (int address) { Address = address; }
+  size_t write (uint8_t) { return 1; }
+  size_t write (const uint8_t *, size_t n) { return n; }
+  using Print::write;
+  uint8_t endTransmission (bool stop = true) { (void) stop; Sim.i2c++; return 0; }
+  uint8_t requestFrom (int address, int n, int stop = 1) {
+    (void) stop;
+    Sim.i2c++;
+    Count = 0; Next = 0;
+    if (address == KEYBOARD_ADDRESS && n > 0) {
+      Buffer[Count++] = simkey();
+    }
+    return Count;
+  }
+  int available () { return Count - Next; }
+  int read () { return (Next < Count) ? Buffer[Next++] : -1; }
+  int peek () { return (Next < Count) ? Buffer[Next] : -1; }
+
+  private:
+  int Address = 0;
+  uint8_t Buffer[32];
+  int Count = 0, Next = 0;
+};
+
+extern TwoWire Wire, Wire1;
+
+#endif
@@ -0,0 +1,27 @@
+/*
+  Host simulator - stand-in for the Adafruit GFX classic font
+
+  Five columns of seven bits per character, as in the real table, but each
+  glyph is a box with the character code in the three columns inside it:
+  bits 1 to 3 of columns 1, 2 and 3 hold bits 0-2, 3-5 and 6-7 of the code.
+  Spaces and control characters are blank. The display reads runs drawn with
+  this font back into its text layer for sedit-sim -t.
+*/
+
+#ifndef GLCDFONT_C
+#define GLCDFONT_C
+
+struct simfont_t {
+  unsigned char bits[256*5];
+  constexpr simfont_t () : bits() {
+    for (int c = ' ' + 1; c < 256; c++) {
+      bits[c*5] = bits[c*5 + 4] = 0x7F;
+      for (int col = 1; col < 4; col++) bits[c*5 + col] = 0x41 | (c>>(3*(col - 1)) & 7)<<1;
+    }
+  }
+  constexpr const unsigned char &operator[] (int i) const { return bits[i]; }
+};
+
+static constexpr simfont_t font;
+
+#endif
@@ -0,0 +1,35 @@
+/*
+  Host simulator - shared state between the stand-in libraries and sim.cpp
+
+  The counters are what the real hardware would have moved: bytes sent to the
+  display over SPI, transactions on the I2C bus to the keyboard and touch
+  controller, and bytes read from or written to the SD card.
+*/
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+  uint64_t spibytes;     // bytes to the display, commands included
+  uint64_t pixels;       // pixels written to the display
+  uint64_t scrolls;      // hardware scroll position changes
+  uint64_t i2c;          // I2C transactions
+  uint64_t sdread;       // bytes read from the SD card
+  uint64_t sdwritten;    // bytes written to the SD card
+  uint64_t sdopens;      // files and directories opened
+  uint64_t keys;         // key codes delivered by the keyboard
+} simcounters_t;
+
+extern simcounters_t Sim;
+
+// Scripted input
+void simpoll ();                                  // run the script up to the current time
+int simkey ();                                    // next key from the keyboard, or 0
+int simtouch (int16_t *x, int16_t *y, int max);   // points touched now
+void simattach (int pin, void (*isr)(), int mode);
+const char *simsdroot ();                         // host directory standing in for the card
+
+#endif
@@ -0,0 +1,291 @@
+/*
+  Host simulator - runs uLisp and the T-Deck extensions as a Linux program
+
+  Input comes from a script of timed keyboard, trackball and touch events;
+  the display, I2C bus and SD card are the stand-ins in include/. When the
+  script is used up and the program asks for another key, the simulator
+  prints what the hardware would have done and exits.
+
+  Script commands, one per line:
+    key <text>          type text; \n \t \\ and \xNN are escapes
+    code <n>            send one raw key code
+    ball <dir> [n [ms]] roll the trackball up, down, left or right n ticks,
+                        ms apart, or all at once
+    touch x y [x2 y2]   put one or two fingers down
+    release             lift all fingers
+    wait <ms>           let time pass
+    # ...               comment
+*/
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <SPI.h>
+#include <SD.h>
+#include <WiFi.h>
+#include <Adafruit_ST7789.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <deque>
+#include <vector>
+
+void setup ();
+void loop ();
+extern Adafruit_ST7789 tft;
+
+simcounters_t Sim;
+HardwareSerial Serial, Serial1, Serial2;
+TwoWire Wire, Wire1;
+SPIClass SPI;
+SDFS SD;
+WiFiClass WiFi;
+EspClass ESP;
+
+// Pins, as wired on the T-Deck
+#define SIM_PINS        64
+#define SIM_TOUCH_INT   16
+#define SIM_TOUCH_EVERY 10
+
+static const struct { const char *name; int pin; } BallPins[] = {
+  { "up", 3 }, { "down", 15 }, { "left", 1 }, { "right", 2 }
+};
+
+// Time
+
+static struct timespec Start;
+
+static uint64_t elapsedus () {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)(now.tv_sec - Start.tv_sec)*1000000 + (now.tv_nsec - Start.tv_nsec)/1000;
+}
+
+unsigned long millis () { simpoll(); return elapsedus()/1000; }
+unsigned long micros () { simpoll(); return elapsedus(); }
+void yield () { simpoll(); }
+
+void delay (unsigned long ms) {
+  uint64_t until = elapsedus() + ms*1000;
+  while (elapsedus() < until) {
+    simpoll();
+    struct timespec nap = { 0, 1000000 };
+    nanosleep(&nap, NULL);
+  }
+}
+
+void delayMicroseconds (unsigned int us) {
+  uint64_t until = elapsedus() + us;
+  while (elapsedus() < until);
+}
+
+// Print and Serial
+
+size_t Print::printf (const char *format, ...) {
+  char buf[256];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  return write((const uint8_t *)buf, min(n, (int)sizeof(buf) - 1));
+}
+
+static int SerialPeek = -1;
+
+int HardwareSerial::peek () {
+  if (this != &Serial) return -1;
+  if (SerialPeek < 0) {
+    unsigned char c;
+    if (::read(0, &c, 1) == 1) SerialPeek = c;
+  }
+  return SerialPeek;
+}
+
+int HardwareSerial::available () { return peek() >= 0; }
+
+int HardwareSerial::read () {
+  int c = peek();
+  SerialPeek = -1;
+  return c;
+}
+
+// Interrupts
+
+static void (*Isr[SIM_PINS])();
+
+void simattach (int pin, void (*isr)(), int mode) {
+  (void) mode;
+  if (pin >= 0 && pin < SIM_PINS) Isr[pin] = isr;
+}
+
+static void simfire (int pin) {
+  if (pin >= 0 && pin < SIM_PINS && Isr[pin] != NULL) Isr[pin]();
+}
+
+// Script
+
+typedef struct {
+  uint64_t at;           // microseconds from the start
+  enum { KEY, BALL, TOUCH, RELEASE } type;
+  int code, n;
+  int16_t x[2], y[2];
+} simevent_t;
+
+static std::deque<simevent_t> Script;
+static std::deque<int> Keys;
+static int16_t TouchX[2], TouchY[2];
+static int Touches;
+static uint64_t TouchPulse, ScriptEnd;
+static const char *SdRoot = ".", *PpmFile, *TextFile;
+
+static void simfinish ();
+
+static void simload (const char *filename) {
+  FILE *in = fopen(filename, "r");
+  if (in == NULL) { perror(filename); exit(1); }
+  char line[512];
+  uint64_t at = 0;
+  int lineno = 0;
+  while (fgets(line, sizeof(line), in)) {
+    lineno++;
+    line[strcspn(line, "\r\n")] = 0;
+    char *p = line;
+    while (isspace(*p)) p++;
+    if (*p == 0 || *p == '#') continue;
+    simevent_t event = { at, simevent_t::KEY, 0, 1, { 0, 0 }, { 0, 0 } };
+    char word[16];
+    int a, b, c, d, m, n = 0;
+    if (strncmp(p, "key ", 4) == 0) {
+      for (p += 4; *p; p++) {
+        event.code = (uint8_t)*p;
+        if (*p == '\\' && p[1]) {
+          p++;
+          if (*p == 'n') event.code = '\n';
+          else if (*p == 't') event.code = '\t';
+          else if (*p == 'x' && isxdigit(p[1]) && isxdigit(p[2])) { char hex[3] = { p[1], p[2], 0 }; event.code = strtol(hex, NULL, 16); p += 2; }
+          else event.code = (uint8_t)*p;
+        }
+        Script.push_back(event);
+      }
+    } else if (sscanf(p, "code %d", &event.code) == 1) {
+      Script.push_back(event);
+    } else if ((m = sscanf(p, "ball %15s %d %d", word, &n, &a)) >= 1) {
+      event.type = simevent_t::BALL;
+      event.n = (n > 0) ? n : 1;
+      event.code = -1;
+      for (size_t i = 0; i < sizeof(BallPins)/sizeof(BallPins[0]); i++) if (strcmp(word, BallPins[i].name) == 0) event.code = BallPins[i].pin;
+      if (event.code < 0) { fprintf(stderr, "%s:%d: no trackball direction %s\n", filename, lineno, word); exit(1); }
+      if (m == 3 && a > 0) {
+        // One tick at a time, and the script's clock moves on with them
+        for (int i = event.n; i > 0; i--) {
+          event.n = 1;
+          Script.push_back(event);
+          if (i > 1) event.at = at = at + (uint64_t)a*1000;
+        }
+      } else Script.push_back(event);
+    } else if ((n = sscanf(p, "touch %d %d %d %d", &a, &b, &c, &d)) >= 2) {
+      event.type = simevent_t::TOUCH;
+      event.n = (n == 4) ? 2 : 1;
+      event.x[0] = a; event.y[0] = b; event.x[1] = c; event.y[1] = d;
+      Script.push_back(event);
+    } else if (strcmp(p, "release") == 0) {
+      event.type = simevent_t::RELEASE;
+      Script.push_back(event);
+    } else if (sscanf(p, "wait %d", &n) == 1) {
+      at += (uint64_t)n*1000;
+    } else {
+      fprintf(stderr, "%s:%d: can't understand %s\n", filename, lineno, p);
+      exit(1);
+    }
+  }
+  ScriptEnd = at;
+  fclose(in);
+}
+
+void simpoll () {
+  static bool busy = false;
+  if (busy) return;
+  busy = true;
+  uint64_t now = elapsedus();
+  while (!Script.empty() && Script.front().at <= now) {
+    simevent_t event = Script.front();
+    Script.pop_front();
+    if (event.type == simevent_t::KEY) Keys.push_back(event.code);
+    else if (event.type == simevent_t::BALL) {
+      for (int i = 0; i < event.n; i++) simfire(event.code);
+    } else {
+      Touches = (event.type == simevent_t::TOUCH) ? event.n : 0;
+      for (int i = 0; i < 2; i++) { TouchX[i] = event.x[i]; TouchY[i] = event.y[i]; }
+      simfire(SIM_TOUCH_INT);
+      TouchPulse = now;
+    }
+  }
+  // The GT911 keeps pulsing its INT line at the report rate while touched
+  if (Touches > 0 && now - TouchPulse >= SIM_TOUCH_EVERY*1000) {
+    simfire(SIM_TOUCH_INT);
+    TouchPulse = now;
+  }
+  busy = false;
+}
+
+int simkey () {
+  simpoll();
+  if (Keys.empty()) {
+    if (Script.empty() && Touches == 0 && elapsedus() >= ScriptEnd) simfinish();
+    return 0;
+  }
+  int key = Keys.front();
+  Keys.pop_front();
+  Sim.keys++;
+  return key;
+}
+
+int simtouch (int16_t *x, int16_t *y, int max) {
+  simpoll();
+  int n = min(Touches, max);
+  for (int i = 0; i < n; i++) { x[i] = TouchX[i]; y[i] = TouchY[i]; }
+  return n;
+}
+
+const char *simsdroot () { return SdRoot; }
+
+// Report
+
+static void simfinish () {
+  fflush(stdout);
+  fprintf(stderr, "\nsedit-sim: %.3f s, %llu keys\n", elapsedus()/1e6, (unsigned long long)Sim.keys);
+  fprintf(stderr, "  display: %llu SPI bytes, %llu pixels, %llu scrolls\n",
+    (unsigned long long)Sim.spibytes, (unsigned long long)Sim.pixels, (unsigned long long)Sim.scrolls);
+  fprintf(stderr, "  I2C:     %llu transactions\n", (unsigned long long)Sim.i2c);
+  fprintf(stderr, "  SD:      %llu bytes read, %llu written, %llu opens\n",
+    (unsigned long long)Sim.sdread, (unsigned long long)Sim.sdwritten, (unsigned long long)Sim.sdopens);
+  if (PpmFile) {
+    FILE *out = fopen(PpmFile, "wb");
+    if (out) { tft.writeppm(out); fclose(out); } else perror(PpmFile);
+  }
+  if (TextFile) {
+    FILE *out = fopen(TextFile, "w");
+    if (out) { tft.writetext(out); fclose(out); } else perror(TextFile);
+  }
+  exit(0);
+}
+
+int main (int argc, char **argv) {
+  const char *script = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "k:s:o:t:")) != -1) {
+    switch (opt) {
+      case 'k': script = optarg; break;
+      case 's': SdRoot = optarg; break;
+      case 'o': PpmFile = optarg; break;
+      case 't': TextFile = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s -k script [-s sdroot] [-o screen.ppm] [-t screen.txt]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (script == NULL) { fprintf(stderr, "%s: no script; give one with -k\n", argv[0]); return 1; }
+  clock_gettime(CLOCK_MONOTONIC, &Start);
+  fcntl(0, F_SETFL, fcntl(0, F_GETFL) | O_NONBLOCK);
+  simload(script);
+  setup();
+  for (;;) loop();
+}